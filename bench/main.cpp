@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <cca/assembler.h>
+#include <cca/corpus.h>
+
+#include <cxxopt/cxxopt.hpp>
+#include <termcolor/termcolor.hpp>
+
+// keeps the optimizer from dropping the work being measured
+volatile std::size_t sink;
+
+struct Stats {
+	double min;
+	double median;
+	double p99;
+};
+
+struct Input {
+	std::string name;
+	std::string source;
+};
+
+// runs setup untimed before every run, only run itself is measured
+template <typename Setup, typename Run>
+Stats measure(int warmup, int runs, Setup setup, Run run) {
+	std::vector<double> samples;
+
+	for (int i = 0; i < warmup + runs; i++) {
+		setup();
+
+		auto begin = std::chrono::high_resolution_clock::now();
+		run();
+		auto end = std::chrono::high_resolution_clock::now();
+
+		if (i >= warmup)
+			samples.push_back(std::chrono::duration<double, std::milli>(end - begin).count());
+	}
+
+	std::sort(samples.begin(), samples.end());
+
+	std::size_t p99 = (samples.size() * 99 + 99) / 100;
+
+	return Stats{samples.front(), samples[samples.size() / 2], samples[std::min(p99, samples.size()) - 1]};
+}
+
+void report(const std::string &phase, const std::string &input, std::size_t bytes, const Stats &stats) {
+	std::cout << "  " << std::left << std::setw(18) << phase << std::setw(16) << input << std::right
+	          << std::fixed << std::setprecision(4)
+	          << termcolor::blue << " | " << termcolor::reset << std::setw(10) << stats.min
+	          << termcolor::blue << " | " << termcolor::reset << std::setw(10) << stats.median
+	          << termcolor::blue << " | " << termcolor::reset << std::setw(10) << stats.p99
+	          << termcolor::blue << " | " << termcolor::reset << std::setw(10) << std::setprecision(1)
+	          << CCA::megabytesPerSecond(bytes, stats.median) << "\n";
+}
+
+// a generated program with the given number of instruction lines and markers
+std::string syntheticSource(std::size_t lines, std::size_t markers, uint64_t seed) {
+	CCA::CorpusOptions options;
+	options.seed = seed;
+	options.lines = lines;
+	options.markers = markers;
+
+	std::ostringstream source;
+	CCA::CorpusGenerator(options).generate(source);
+
+	return source.str();
+}
+
+std::string numberCorpus(unsigned int count, unsigned int seed) {
+	std::mt19937 random(seed);
+	std::ostringstream numbers;
+
+	for (unsigned int i = 0; i < count; i++) {
+		switch (random() % 4) {
+			case 0:
+				numbers << random() % 100000 << " ";
+				break;
+			case 1:
+				numbers << "0x" << random() % 10 << " ";
+				break;
+			case 2:
+				numbers << "0b1" << random() % 2 << "01 ";
+				break;
+			default:
+				numbers << "0o" << random() % 8 << "7 ";
+		}
+	}
+
+	return numbers.str();
+}
+
+std::string escapeCorpus(std::size_t length) {
+	std::string value;
+	const char *pieces[] = {"plain text ", "\\n", "\\t", "\\\\", "more words", "\\e", "\\\"", "\\q"};
+
+	for (std::size_t i = 0; value.size() < length; i++)
+		value += pieces[i % 8];
+
+	return value;
+}
+
+void benchInput(const Input &input, int warmup, int runs) {
+	CCA::StringRef code(input.source);
+
+	report("lexer", input.name, code.size(), measure(warmup, runs, [] {}, [&] {
+		sink = CCA::lexer(code).size();
+	}));
+
+	std::vector<CCA::Token> lexed = CCA::lexer(code);
+	std::vector<CCA::Token> tokens;
+	CCA::Program program;
+
+	report("parseDefinitions", input.name, code.size(), measure(warmup, runs, [&] {
+		tokens = lexed;
+		program = CCA::Program();
+	}, [&] {
+		CCA::parseDefinitions(tokens, program);
+	}));
+
+	std::vector<CCA::Token> definitionsParsed = tokens;
+	CCA::Program afterDefinitions = program;
+
+	report("postTokenizer", input.name, code.size(), measure(warmup, runs, [&] {
+		tokens = definitionsParsed;
+		program = afterDefinitions;
+	}, [&] {
+		CCA::postTokenizer(tokens, program);
+	}));
+
+	CCA::layoutInstructions(program);
+	CCA::resolveSymbols(program);
+
+	std::vector<unsigned char> bytecode;
+	CCA::generateBytecode(program, bytecode);
+
+	// throughput in bytes of code produced
+	report("generateBytecode", input.name, bytecode.size(), measure(warmup, runs, [&] {
+		bytecode.clear();
+	}, [&] {
+		CCA::generateBytecode(program, bytecode);
+	}));
+
+	std::vector<unsigned char> data;
+	std::size_t escapedBytes = 0;
+
+	for (auto &d: program.definitions)
+		escapedBytes += d.value.size();
+
+	report("decodeEscapes", input.name, escapedBytes, measure(warmup, runs, [&] {
+		data.clear();
+	}, [&] {
+		for (auto &d: program.definitions)
+			CCA::decodeEscapes(d.value, data);
+	}));
+}
+
+int main(int argc, char *argv[]) {
+	cxxopts::Options options("ccb-bench", "Microbenchmarks of the CC Assembler phases\n");
+
+	options.add_options()
+		("r,runs", "Measured runs per benchmark", cxxopts::value<int>()->default_value("50"))
+		("w,warmup", "Unmeasured runs before measuring", cxxopts::value<int>()->default_value("5"))
+		("no-synthetic", "Skip the generated inputs")
+		("h,help", "Display this information");
+
+	cxxopts::ParseResult result;
+
+	try {
+		result = options.parse(argc, argv);
+	} catch (const cxxopts::OptionParseException &e) {
+		std::cout << termcolor::red << "[ERROR] " << termcolor::reset << e.what() << "\n\n";
+		std::exit(-1);
+	}
+
+	if (result.count("help")) {
+		std::cout << options.help() << "\n";
+		std::exit(0);
+	}
+
+	int runs = std::max(1, result["runs"].as<int>());
+	int warmup = std::max(0, result["warmup"].as<int>());
+
+	// the positional arguments, or the bundled examples
+	std::vector<std::string> files = result.unmatched();
+
+	if (files.empty()) {
+		std::stringstream examples(CCA_BENCH_EXAMPLES);
+		std::string file;
+
+		while (std::getline(examples, file, ','))
+			files.push_back(file);
+	}
+
+	std::vector<Input> inputs;
+
+	for (auto &file: files) {
+		CCA::SourceFile source;
+
+		// readFile has said what went wrong
+		try {
+			CCA::readFile(file, source);
+		} catch (const CCA::AssemblyError &) {
+			std::exit(-1);
+		}
+
+		inputs.push_back(Input{file.substr(file.find_last_of("/\\") + 1), source.contents().str()});
+	}
+
+	if (!result.count("no-synthetic")) {
+		inputs.push_back(Input{"synthetic-10k", syntheticSource(10000, 500, 1)});
+		inputs.push_back(Input{"synthetic-1m", syntheticSource(1000000, 20000, 2)});
+	}
+
+	std::cout << "  " << std::left << std::setw(18) << "phase" << std::setw(16) << "input" << std::right
+	          << termcolor::blue << " | " << termcolor::reset << std::setw(10) << "min ms"
+	          << termcolor::blue << " | " << termcolor::reset << std::setw(10) << "median ms"
+	          << termcolor::blue << " | " << termcolor::reset << std::setw(10) << "p99 ms"
+	          << termcolor::blue << " | " << termcolor::reset << std::setw(10) << "MB/s" << "\n";
+
+	std::string numbers = numberCorpus(100000, 3);
+
+	report("parseNumber", "numbers-100k", numbers.size(), measure(warmup, runs, [] {}, [&] {
+		CCA::StringRef code(numbers);
+		std::size_t total = 0;
+
+		for (std::size_t i = 0; i < code.size(); i++) {
+			if (CCA::isNumber(code[i]))
+				total += CCA::parseNumber(code, i);
+		}
+
+		sink = total;
+	}));
+
+	std::string escapes = escapeCorpus(1 << 20);
+	std::vector<unsigned char> decoded;
+
+	report("decodeEscapes", "escapes-1m", escapes.size(), measure(warmup, runs, [&] {
+		decoded.clear();
+	}, [&] {
+		CCA::decodeEscapes(escapes, decoded);
+	}));
+
+	// an input that doesn't assemble can't be measured, the pipeline has reported its errors
+	try {
+		for (auto &input: inputs)
+			benchInput(input, warmup, runs);
+	} catch (const CCA::AssemblyError &) {
+		std::exit(-1);
+	}
+
+	return 0;
+}
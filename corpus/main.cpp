@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <cca/assembler.h>
+#include <cca/corpus.h>
+
+#include <cxxopt/cxxopt.hpp>
+#include <termcolor/termcolor.hpp>
+
+[[noreturn]] void fail(const std::string &message) {
+	std::cout << termcolor::red << "[ERROR] " << termcolor::reset << message << "\n";
+	std::exit(-1);
+}
+
+// "rn=3,rr,none=0.5", forms that are not listed are not generated
+void parseForms(const std::string &list, CCA::CorpusOptions &options) {
+	std::stringstream forms(list);
+	std::string form;
+
+	for (double &weight: options.formWeights)
+		weight = 0;
+
+	while (std::getline(forms, form, ',')) {
+		std::size_t equals = form.find('=');
+		int signature = CCA::parseSignatureName(form.substr(0, equals));
+
+		if (signature == CCA::NO_SIGNATURE)
+			fail("Unknown operand form \"" + form.substr(0, equals) + "\"");
+
+		double weight = 1;
+
+		if (equals != std::string::npos) {
+			try {
+				weight = std::stod(form.substr(equals + 1));
+			} catch (const std::exception &) {
+				fail("Invalid weight in \"" + form + "\"");
+			}
+		}
+
+		options.formWeights[signature] = weight;
+	}
+}
+
+int main(int argc, char *argv[]) {
+	cxxopts::Options options("ccb-corpus", "Generates CC assembly of a given shape for benchmarking\n");
+
+	options.add_options()
+		("o,output", "Write to this file instead of stdout", cxxopts::value<std::string>())
+		("seed", "Seed, the same seed and options give the same program", cxxopts::value<uint64_t>()->default_value("1"))
+		("lines", "Instruction lines", cxxopts::value<std::size_t>()->default_value("100000"))
+		("size", "Approximate output size, like 64M or 1G, instead of --lines", cxxopts::value<std::string>())
+		("markers", "Markers, spread evenly (default: one every 20 lines)", cxxopts::value<std::size_t>())
+		("jumps", "Share of the lines that jump to a marker", cxxopts::value<double>()->default_value("0.1"))
+		("forward", "Share of the jumps that go forward", cxxopts::value<double>()->default_value("0.5"))
+		("defs", "Def strings", cxxopts::value<std::size_t>()->default_value("16"))
+		("def-length", "Source characters per def string", cxxopts::value<std::size_t>()->default_value("32"))
+		("escapes", "Share of the def strings that is escape sequences", cxxopts::value<double>()->default_value("0.1"))
+		("comments", "Share of the lines with a trailing comment", cxxopts::value<double>()->default_value("0.1"))
+		("forms", "Operand forms with optional weights, like rn=3,rr,a (forms: none, r, n, a, rr, rn, ra, nr, nn, na, ar, an, aa)",
+			cxxopts::value<std::string>())
+		("h,help", "Display this information");
+
+	cxxopts::ParseResult result;
+
+	try {
+		result = options.parse(argc, argv);
+	} catch (const cxxopts::OptionParseException &e) {
+		fail(e.what());
+	}
+
+	if (result.count("help")) {
+		std::cout << options.help() << "\n";
+		std::exit(0);
+	}
+
+	CCA::CorpusOptions corpus;
+	corpus.seed = result["seed"].as<uint64_t>();
+	corpus.lines = result["lines"].as<std::size_t>();
+	corpus.jumps = result["jumps"].as<double>();
+	corpus.forward = result["forward"].as<double>();
+	corpus.defs = result["defs"].as<std::size_t>();
+	corpus.defLength = result["def-length"].as<std::size_t>();
+	corpus.escapes = result["escapes"].as<double>();
+	corpus.comments = result["comments"].as<double>();
+
+	if (result.count("forms"))
+		parseForms(result["forms"].as<std::string>(), corpus);
+
+	if (!CCA::CorpusGenerator(corpus).valid())
+		fail("No operand form left to generate");
+
+	if (result.count("size")) {
+		uint64_t size = 0;
+
+		if (!CCA::parseByteSize(result["size"].as<std::string>(), size))
+			fail("Invalid size \"" + result["size"].as<std::string>() + "\"");
+
+		// measure the average line of this shape on a sample, then scale the line count to the size
+		CCA::CorpusOptions sample = corpus;
+		sample.lines = 10000;
+		sample.defs = 0;
+		sample.markers = result.count("markers") ? 0 : sample.lines / 20;
+
+		std::ostringstream sampleStream;
+		std::size_t sampleBytes = CCA::CorpusGenerator(sample).generate(sampleStream);
+
+		corpus.lines = std::max<std::size_t>(1, size / (sampleBytes / static_cast<double>(sample.lines)));
+	}
+
+	corpus.markers = result.count("markers") ? result["markers"].as<std::size_t>() : corpus.lines / 20;
+
+	std::ofstream file;
+	std::ostream *output = &std::cout;
+
+	if (result.count("output")) {
+		file.open(result["output"].as<std::string>(), std::ios::binary);
+
+		if (!file)
+			fail("Unable to open \"" + result["output"].as<std::string>() + "\"");
+
+		output = &file;
+	}
+
+	CCA::CorpusGenerator(corpus).generate(*output);
+	output->flush();
+
+	if (!*output)
+		fail("Unable to write the corpus");
+
+	return 0;
+}
@@ -1,41 +1,151 @@
+#pragma once
+
 // stdlib headers
 #include <iostream>
 #include <fstream>
 #include <cstdlib>
+#include <cstring>
+#include <cerrno>
 #include <streambuf>
 #include <string>
 #include <vector>
 #include <algorithm>
 #include <chrono>
 #include <map>
+#include <sstream>
+#include <deque>
+#include <memory>
+#include <ctime>
+#include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
 #include <math.h>
 
+// platform headers
+#if defined(__unix__) || defined(__APPLE__)
+#define CCA_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define CCA_HAS_DIRENT 1
+#include <dirent.h>
+#define CCA_HAS_UNIX_SOCKETS 1
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#endif
+
 // other libraries
 #include <termcolor/termcolor.hpp>
+
+// libcca leaves out the command line, watch and batch modes
+#ifndef CCA_LIBRARY
 #include <cxxopt/cxxopt.hpp>
 #include <FileWatcher/FileWatcher.h>
+#endif
+
+// assembler headers
+#include <cca/cca.h>
+#include <cca/profiling.h>
+
+#ifndef CCA_LIBRARY
+#include <cca/cache.h>
+#endif
 
 // how to compile:
 // g++ main.cpp -o cca -std=c++11 && ./cca test.cca
 
 namespace CCA {
-    std::string replace(std::string str, const std::string &sub1, const std::string &sub2) {
-        if (sub1.empty())
-            return str;
+    // --version, part of the build cache keys as well
+    const char *const assemblerVersion = "1.0.0";
+
+    // a byte count like 1048576, 512K, 64M or 1G, false if it is malformed or doesn't fit in 64 bits
+    bool parseByteSize(const std::string &value, uint64_t &size) {
+        // stoull would take a sign, and wrap a negative count around
+        if (value.empty() || value[0] < '0' || value[0] > '9')
+            return false;
+
+        std::size_t end = 0;
+
+        try {
+            size = std::stoull(value, &end);
+        } catch (const std::exception &) {
+            return false;
+        }
+
+        std::string suffix = value.substr(end);
+        int shift = 0;
+
+        if (suffix == "K" || suffix == "k")
+            shift = 10;
+        else if (suffix == "M" || suffix == "m")
+            shift = 20;
+        else if (suffix == "G" || suffix == "g")
+            shift = 30;
+        else if (!suffix.empty())
+            return false;
+
+        if (size > (UINT64_MAX >> shift))
+            return false;
+
+        size <<= shift;
+        return true;
+    }
+
+    // non-owning view of a piece of the source, tokens point into the source buffer
+    // instead of each owning a copy of their text
+    struct StringRef {
+        const char *data;
+        std::size_t length;
+
+        StringRef() : data(""), length(0) {}
 
-        std::size_t pos;
+        StringRef(const char *_data, std::size_t _length) : data(_data), length(_length) {}
 
-        while ((pos = str.find(sub1)) != std::string::npos)
-            str.replace(pos, sub1.size(), sub2);
+        StringRef(const char *_data) : data(_data), length(std::strlen(_data)) {}
 
-        return str;
+        StringRef(const std::string &_str) : data(_str.data()), length(_str.size()) {}
+
+        std::size_t size() const {
+            return length;
+        }
+
+        bool empty() const {
+            return length == 0;
+        }
+
+        char operator[](std::size_t index) const {
+            return data[index];
+        }
+
+        // like std::string, reading at (or past) the end yields '\0'
+        char at(std::size_t index) const {
+            return index < length ? data[index] : '\0';
+        }
+
+        std::string str() const {
+            return std::string(data, length);
+        }
+    };
+
+    bool operator==(const StringRef &a, const StringRef &b) {
+        return a.length == b.length && std::memcmp(a.data, b.data, a.length) == 0;
     }
 
-    bool in_array(const std::string &value, const std::vector<std::string> &array) {
-        return std::find(array.begin(), array.end(), value) != array.end();
+    bool operator!=(const StringRef &a, const StringRef &b) {
+        return !(a == b);
     }
 
-    enum class TokenType {
+    std::ostream &operator<<(std::ostream &stream, const StringRef &s) {
+        return stream.write(s.data, s.length);
+    }
+
+    enum class TokenType : unsigned char {
         IDENTIFIER,
         NUMBER,
         DIVIDER,
@@ -48,23 +158,208 @@ namespace CCA {
         UNKNOWN
     };
 
+    // every mnemonic the lexer recognizes, COUNT is the number of opcodes
+    enum class Opcode {
+        RAND,
+        POW,
+        MOD,
+        MOV,
+        STP,
+        SYSCALL,
+        PUSH,
+        POP,
+        DUP,
+        ADD,
+        SUB,
+        MUL,
+        DIV,
+        NOT,
+        AND,
+        OR,
+        XOR,
+        JMP,
+        JE,
+        JNE,
+        JG,
+        JS,
+        JO,
+        FRS,
+        INC,
+        DEC,
+        CALL,
+        RET,
+        CMP,
+        SQRT,
+        ROOT,
+        COUNT
+    };
+
+    // mnemonics by Opcode id
+    const char *const opcodeNames[] = {"rand", "pow", "mod", "mov", "stp", "syscall", "push", "pop", "dup", "add",
+                                       "sub", "mul", "div", "not", "and", "or", "xor", "jmp", "je", "jne", "jg",
+                                       "js", "jo", "frs", "inc", "dec", "call", "ret", "cmp", "sqrt", "root"};
+
     struct Token {
         TokenType type;
         int lineFound;
-        std::string valString;
+        StringRef valString;
         int valNumeric;
-        int byteIndex;
     };
 
     struct Definition {
-        int index;
-        std::string value;
-        std::string name;
+        int index; // offset of the decoded string in the data section
+        StringRef value;
+        StringRef name;
     };
 
     struct Marker {
-        std::string name;
+        StringRef name;
         int byteIndex;
+        unsigned int instruction; // index of the instruction the marker points at
+    };
+
+    enum class SymbolType {
+        MARKER,
+        DEFINITION,
+        UNRESOLVED // used but not seen yet while assembling in one pass, value is its first fixup
+    };
+
+    struct Symbol {
+        StringRef name;
+        SymbolType type;
+        int value;
+        int lineFound;
+    };
+
+    // markers and definitions by name, open addressing with linear probing. Every name is
+    // stored once, so inserting an existing name hands back the symbol that already owns it
+    class SymbolTable {
+    private:
+        struct Slot {
+            uint32_t hash;
+            uint32_t index; // index into symbols + 1, 0 marks an empty slot
+        };
+
+        std::vector<Symbol> symbols;
+        std::vector<Slot> slots;
+
+        static uint32_t hash(const StringRef &name) {
+            // FNV-1a
+            uint32_t h = 2166136261u;
+
+            for (std::size_t i = 0; i < name.size(); i++) {
+                h ^= static_cast<unsigned char>(name[i]);
+                h *= 16777619u;
+            }
+
+            return h;
+        }
+
+        std::size_t findSlot(const StringRef &name, uint32_t h) const {
+            std::size_t mask = slots.size() - 1;
+            std::size_t i = h & mask;
+
+            while (slots[i].index != 0) {
+                if (slots[i].hash == h && symbols[slots[i].index - 1].name == name)
+                    break;
+
+                i = (i + 1) & mask;
+            }
+
+            return i;
+        }
+
+        void grow() {
+            std::vector<Slot> old(slots.size() == 0 ? 16 : slots.size() * 2, Slot{0, 0});
+            old.swap(slots);
+
+            for (auto &slot: old) {
+                if (slot.index != 0)
+                    slots[findSlot(symbols[slot.index - 1].name, slot.hash)] = slot;
+            }
+        }
+
+    public:
+        // returns nullptr if the name was free, or the symbol that already uses it
+        const Symbol *insert(const Symbol &symbol) {
+            // keep the load factor at or below one half
+            if ((symbols.size() + 1) * 2 > slots.size())
+                grow();
+
+            uint32_t h = hash(symbol.name);
+            std::size_t i = findSlot(symbol.name, h);
+
+            if (slots[i].index != 0)
+                return &symbols[slots[i].index - 1];
+
+            symbols.push_back(symbol);
+            slots[i] = Slot{h, static_cast<uint32_t>(symbols.size())};
+
+            return nullptr;
+        }
+
+        const Symbol *find(const StringRef &name) const {
+            if (slots.empty())
+                return nullptr;
+
+            std::size_t i = findSlot(name, hash(name));
+
+            if (slots[i].index == 0)
+                return nullptr;
+
+            return &symbols[slots[i].index - 1];
+        }
+
+        // the name of the returned symbol must not be changed
+        Symbol *find(const StringRef &name) {
+            return const_cast<Symbol *>(static_cast<const SymbolTable *>(this)->find(name));
+        }
+
+        std::size_t size() const {
+            return symbols.size();
+        }
+
+        // names must not be changed through these
+        std::vector<Symbol>::iterator begin() {
+            return symbols.begin();
+        }
+
+        std::vector<Symbol>::iterator end() {
+            return symbols.end();
+        }
+    };
+
+    // a lowered instruction, operands are REGISTER (register number), NUMBER or ADDRESS
+    struct IRInstruction {
+        unsigned char opcode; // Opcode id
+        signed char signature; // operand shape, see operandSignature
+        unsigned char operandCount;
+        TokenType operandTypes[2];
+        int operands[2];
+        int lineFound;
+        int byteIndex; // assigned by layoutInstructions
+    };
+
+    // an operand naming a marker or definition, filled in by resolveSymbols
+    struct SymbolReference {
+        StringRef name;
+        int lineFound;
+        unsigned int instruction;
+        unsigned int operand;
+    };
+
+    // what the front-end extracts from the tokens, everything after it works on this instead of tokens
+    struct Program {
+        std::vector<IRInstruction> instructions;
+        std::vector<SymbolReference> references;
+        SymbolTable symbols;
+
+        // decoded def strings, laid out back to back as they appear in the data section
+        std::vector<unsigned char> data;
+
+        // kept for the debug output
+        std::vector<Definition> definitions;
+        std::vector<Marker> markers;
     };
 
     struct Instruction {
@@ -72,36 +367,302 @@ namespace CCA {
         std::vector<TokenType> args;
     };
 
-    std::string readFile(std::string &fileName) {
-        std::ifstream file(fileName);
-        std::string content;
+    // thrown where an assembly gives up, the errors are reported by then, a watcher can catch it and carry on
+    struct AssemblyError {};
+
+    // thrown between phases once a newer change has made the build pointless
+    struct AssemblyCancelled {};
+
+    // where this thread's errors go instead of the console, nullptr to print them
+    std::vector<Diagnostic> *&diagnosticLog() {
+        static thread_local std::vector<Diagnostic> *log = nullptr;
+        return log;
+    }
+
+    // collects the errors of this thread into diagnostics for as long as it lives
+    class DiagnosticCapture {
+    private:
+        std::vector<Diagnostic> *previous;
+
+    public:
+        explicit DiagnosticCapture(std::vector<Diagnostic> &diagnostics) : previous(diagnosticLog()) {
+            diagnosticLog() = &diagnostics;
+        }
+
+        DiagnosticCapture(const DiagnosticCapture &) = delete;
+        DiagnosticCapture &operator=(const DiagnosticCapture &) = delete;
 
-        if (!file.is_open()) {
-            std::cout << termcolor::red << "[ERROR]" << termcolor::reset << " Could not open file '" << fileName
-                      << "', are you sure it exists?\n\n";
-            std::exit(-1);
+        ~DiagnosticCapture() {
+            diagnosticLog() = previous;
         }
+    };
 
-        file.seekg(0, std::ios::end);
-        content.reserve(file.tellg());
-        file.seekg(0, std::ios::beg);
+    // line is 0 for errors that belong to no line, end is what the console gets after the message
+    void reportError(int line, const std::string &message, const char *end = "\n\n") {
+        if (std::vector<Diagnostic> *log = diagnosticLog()) {
+            Diagnostic diagnostic;
+            diagnostic.line = line;
+            diagnostic.message = message;
+            log->push_back(diagnostic);
+            return;
+        }
 
-        content.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        console() << termcolor::red << "[ERROR]" << termcolor::reset << " " << message << end;
+    }
 
-        file.close();
-        return content;
+    // gives up on the assembly after the errors of a phase, the summary only goes to the console
+    [[noreturn]] void abortAssembly(const std::string &phase, const char *end = "\n\n") {
+        if (!diagnosticLog())
+            console() << termcolor::red << "[ERROR]" << termcolor::reset << " Aborting due to errors while " << phase
+                      << end;
+
+        throw AssemblyError();
+    }
+
+    // reads whatever standard input has at the moment, up to size bytes, got is 0 at its end
+    bool readInput(char *buffer, std::size_t size, std::size_t &got) {
+#ifdef CCA_HAS_MMAP
+        ssize_t count;
+
+        do {
+            count = ::read(0, buffer, size);
+        } while (count < 0 && errno == EINTR);
+
+        got = count > 0 ? count : 0;
+        return count >= 0;
+#else
+        std::cin.read(buffer, size);
+        got = std::cin.gcount();
+        return !std::cin.bad();
+#endif
     }
 
-    bool isRegisterOrInstruction(std::string code) {
-        std::vector<std::string> opcodes = {"rand", "pow", "mod", "mov", "stp", "syscall", "push", "pop", "dup", "add",
-                                            "sub", "mul", "div", "not", "and", "or", "xor", "jmp", "je", "jne", "jg",
-                                            "js", "jo", "frs", "inc", "dec", "call", "ret", "cmp"};
-        std::vector<std::string> registers = {"a", "b", "c", "d"};
+    // read-only input file, regular files are memory mapped so the lexer can read straight
+    // out of the page cache, pipes and special files are streamed into an owned buffer
+    class SourceFile {
+    private:
+        std::string buffer;
+
+        const char *mapping = nullptr;
+        std::size_t mappingSize = 0;
+
+        bool map(const std::string &fileName) {
+#ifdef CCA_HAS_MMAP
+            int fd = ::open(fileName.c_str(), O_RDONLY);
+
+            if (fd < 0)
+                return false;
+
+            struct stat info;
+
+            // only regular, non-empty files can be mapped
+            if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0) {
+                ::close(fd);
+                return false;
+            }
+
+            void *address = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+
+            if (address == MAP_FAILED)
+                return false;
+
+            madvise(address, info.st_size, MADV_SEQUENTIAL);
+
+            mapping = static_cast<const char *>(address);
+            mappingSize = info.st_size;
 
-        // indentify the opcodes
-        if (in_array(code, opcodes) || in_array(code, registers))
             return true;
-        return false;
+#else
+            return false;
+#endif
+        }
+
+        bool stream(const std::string &fileName) {
+            char chunk[1 << 16];
+
+            // standard input
+            if (fileName == "-") {
+                std::size_t got;
+                bool read;
+
+                while ((read = readInput(chunk, sizeof(chunk), got)) && got > 0)
+                    buffer.append(chunk, got);
+
+                // a failed read ends the loop with nothing read as well
+                return read;
+            }
+
+            std::ifstream file(fileName, std::ios::binary);
+
+            if (!file.is_open())
+                return false;
+
+            while (file.read(chunk, sizeof(chunk)) || file.gcount() > 0)
+                buffer.append(chunk, file.gcount());
+
+            return true;
+        }
+
+        void close() {
+#ifdef CCA_HAS_MMAP
+            if (mapping)
+                munmap(const_cast<char *>(mapping), mappingSize);
+#endif
+            mapping = nullptr;
+            mappingSize = 0;
+            buffer.clear();
+        }
+
+    public:
+        SourceFile() {}
+
+        SourceFile(const SourceFile &) = delete;
+
+        SourceFile &operator=(const SourceFile &) = delete;
+
+        ~SourceFile() {
+            close();
+        }
+
+        // a mapping dies with SIGBUS when the file is truncated under it, files that may be rewritten while
+        // they are read, like in watch mode, have to be copied
+        bool open(const std::string &fileName, bool allowMapping = true) {
+            close();
+
+            return (allowMapping && fileName != "-" && map(fileName)) || stream(fileName);
+        }
+
+        StringRef contents() const {
+            if (mapping)
+                return StringRef(mapping, mappingSize);
+
+            return StringRef(buffer);
+        }
+
+        // hands the contents over as an owned string, copying only if they are mapped
+        std::string release() {
+            std::string contents = mapping ? std::string(mapping, mappingSize) : std::move(buffer);
+            close();
+
+            return contents;
+        }
+    };
+
+    void readFile(const std::string &fileName, SourceFile &source, bool allowMapping = true) {
+        if (!source.open(fileName, allowMapping)) {
+            if (fileName == "-")
+                reportError(0, "Could not read standard input");
+            else
+                reportError(0, "Could not open file '" + fileName + "', are you sure it exists?");
+
+            throw AssemblyError();
+        }
+    }
+
+    // classifies a word as OPCODE, REGISTER or plain IDENTIFIER without allocating, id receives the
+    // Opcode for opcodes and the register number for registers
+    TokenType classifyWord(const StringRef &word, int &id) {
+        Opcode opcode = Opcode::COUNT;
+
+        switch (word.size()) {
+            case 1:
+                if (word[0] >= 'a' && word[0] <= 'd') {
+                    id = word[0] - 'a';
+                    return TokenType::REGISTER;
+                }
+                break;
+            case 2:
+                if (word == "or")
+                    opcode = Opcode::OR;
+                else if (word[0] == 'j') {
+                    switch (word[1]) {
+                        case 'e':
+                            opcode = Opcode::JE;
+                            break;
+                        case 'g':
+                            opcode = Opcode::JG;
+                            break;
+                        case 's':
+                            opcode = Opcode::JS;
+                            break;
+                        case 'o':
+                            opcode = Opcode::JO;
+                            break;
+                    }
+                }
+                break;
+            case 3:
+                switch (word[0]) {
+                    case 'a':
+                        if (word == "add") opcode = Opcode::ADD;
+                        else if (word == "and") opcode = Opcode::AND;
+                        break;
+                    case 'c':
+                        if (word == "cmp") opcode = Opcode::CMP;
+                        break;
+                    case 'd':
+                        if (word == "dup") opcode = Opcode::DUP;
+                        else if (word == "div") opcode = Opcode::DIV;
+                        else if (word == "dec") opcode = Opcode::DEC;
+                        break;
+                    case 'f':
+                        if (word == "frs") opcode = Opcode::FRS;
+                        break;
+                    case 'i':
+                        if (word == "inc") opcode = Opcode::INC;
+                        break;
+                    case 'j':
+                        if (word == "jmp") opcode = Opcode::JMP;
+                        else if (word == "jne") opcode = Opcode::JNE;
+                        break;
+                    case 'm':
+                        if (word == "mov") opcode = Opcode::MOV;
+                        else if (word == "mod") opcode = Opcode::MOD;
+                        else if (word == "mul") opcode = Opcode::MUL;
+                        break;
+                    case 'n':
+                        if (word == "not") opcode = Opcode::NOT;
+                        break;
+                    case 'p':
+                        if (word == "pow") opcode = Opcode::POW;
+                        else if (word == "pop") opcode = Opcode::POP;
+                        break;
+                    case 'r':
+                        if (word == "ret") opcode = Opcode::RET;
+                        break;
+                    case 's':
+                        if (word == "stp") opcode = Opcode::STP;
+                        else if (word == "sub") opcode = Opcode::SUB;
+                        break;
+                    case 'x':
+                        if (word == "xor") opcode = Opcode::XOR;
+                        break;
+                }
+                break;
+            case 4:
+                if (word == "rand")
+                    opcode = Opcode::RAND;
+                else if (word == "push")
+                    opcode = Opcode::PUSH;
+                else if (word == "call")
+                    opcode = Opcode::CALL;
+                else if (word == "sqrt")
+                    opcode = Opcode::SQRT;
+                else if (word == "root")
+                    opcode = Opcode::ROOT;
+                break;
+            case 7:
+                if (word == "syscall")
+                    opcode = Opcode::SYSCALL;
+                break;
+        }
+
+        if (opcode == Opcode::COUNT)
+            return TokenType::IDENTIFIER;
+
+        id = static_cast<int>(opcode);
+        return TokenType::OPCODE;
     }
 
     bool isIgnorable(char c) {
@@ -136,45 +697,47 @@ namespace CCA {
         return c == ':';
     }
 
-    std::string parseWord(std::string &code, unsigned int &readingIndex) {
-        std::string result = "";
+    StringRef parseWord(const StringRef &code, std::size_t &readingIndex) {
+        std::size_t start = readingIndex;
+
+        while (isIdentifier(code.at(readingIndex)))
+            ++readingIndex;
 
-        while (isIdentifier(code[readingIndex]))
-            result += code[readingIndex++];
+        StringRef result(code.data + start, readingIndex - start);
 
         --readingIndex;
 
         return result;
     }
 
-    std::string parseString(std::string &code, unsigned int &readingIndex) {
-        std::string result = "";
+    StringRef parseString(const StringRef &code, std::size_t &readingIndex) {
+        std::size_t start = readingIndex;
 
-        while (!isString(code[readingIndex]))
-            result += code[readingIndex++];
+        while (readingIndex < code.size() && !isString(code[readingIndex]))
+            ++readingIndex;
 
-        return result;
+        return StringRef(code.data + start, readingIndex - start);
     }
 
-    int parseNumber(std::string &code, unsigned int &readingIndex) {
+    int parseNumber(const StringRef &code, std::size_t &readingIndex) {
         std::string result = "";
 
         int index = 0;
         int base = 10;
 
-        while (isNumber(code[readingIndex])) {
-            if (index == 0 && code[readingIndex] == '0' && code[readingIndex + 1] == 'x') {
+        while (isNumber(code.at(readingIndex))) {
+            if (index == 0 && code[readingIndex] == '0' && code.at(readingIndex + 1) == 'x') {
                 base = 16;
                 readingIndex += 2;
-            } else if (index == 0 && code[readingIndex] == '0' && code[readingIndex + 1] == 'b') {
+            } else if (index == 0 && code[readingIndex] == '0' && code.at(readingIndex + 1) == 'b') {
                 base = 2;
                 readingIndex += 2;
-            } else if (index == 0 && code[readingIndex] == '0' && code[readingIndex + 1] == 'o') {
+            } else if (index == 0 && code[readingIndex] == '0' && code.at(readingIndex + 1) == 'o') {
                 base = 8;
                 readingIndex += 2;
             }
 
-            result += code[readingIndex++];
+            result += code.at(readingIndex++);
             ++index;
         }
 
@@ -192,192 +755,388 @@ namespace CCA {
         return std::stoi(result);
     }
 
-    std::vector<Token> lexer(std::string code) {
-        std::vector<Token> tokens;
+    // hands out the tokens of the code one at a time, the tokens reference the code so it has to outlive them
+    class Lexer {
+    private:
+        StringRef code;
+        std::size_t readingIndex = 0;
         int lineFound = 1;
         bool error = false;
-        bool foundDef = false;
-        int byteIndex = 0;
+        bool quiet = false;
+        bool partial = false;
+
+        void fail(const std::string &message) {
+            if (!quiet)
+                reportError(lineFound, message, "\n");
 
-        for (unsigned int readingIndex = 0; readingIndex < code.size(); readingIndex++) {
-            char currentCharacter = code[readingIndex];
+            error = true;
+        }
 
-            if (currentCharacter == '\n') {
-                lineFound++;
+        // a malformed number like the one in "&x" or one that doesn't fit is an error, not an exception
+        bool readNumber(int &value) {
+            try {
+                value = parseNumber(code, readingIndex);
+                return true;
+            } catch (const std::logic_error &) {
+                fail("Invalid number on line " + std::to_string(lineFound));
+                return false;
             }
+        }
 
-            if (isIgnorable(currentCharacter)) {
-                continue;
-            } else if (isMarker(currentCharacter)) {
-                ++readingIndex;
-                std::string value = parseWord(code, readingIndex);
-
-                tokens.push_back(Token{
-                        TokenType::MARKER,
-                        lineFound,
-                        value,
-                        0,
-                        byteIndex
-                });
-            } else if (isDivider(currentCharacter)) {
-                tokens.push_back(Token{
-                        TokenType::DIVIDER,
-                        lineFound,
-                        ",",
-                        0,
-                        byteIndex
-                });
-            } else if (isIdentifier(currentCharacter)) {
-                std::string value = parseWord(code, readingIndex);
+    public:
+        explicit Lexer(const StringRef &_code) : code(_code) {}
 
-                tokens.push_back(Token{
-                        TokenType::IDENTIFIER,
-                        lineFound,
-                        value,
-                        0,
-                        byteIndex
-                });
+        // resumes lexing at a token boundary, lineFound being the line the lexer was on there. A quiet lexer
+        // only remembers that it failed
+        Lexer(const StringRef &_code, std::size_t start, int line, bool _quiet)
+                : code(_code), readingIndex(start), lineFound(line), quiet(_quiet) {}
 
-                ++byteIndex;
-
-                if (foundDef) {
-                    foundDef = false;
-                    --byteIndex;
-                } else if (value == "def") {
-                    foundDef = true;
-                    --byteIndex;
-                } else if (!isRegisterOrInstruction(value)) {
-                    byteIndex += 3;
-                }
-            } else if (isNumber(currentCharacter)) {
-                int value = parseNumber(code, readingIndex);
-
-                tokens.push_back(Token{
-                        TokenType::NUMBER,
-                        lineFound,
-                        "",
-                        value,
-                        byteIndex
-                });
+        // false once the end of the code is reached
+        bool next(Token &token) {
+            for (; readingIndex < code.size(); readingIndex++) {
+                char currentCharacter = code[readingIndex];
+                bool found = true;
 
-                byteIndex += 4;
-            } else if (isAddress(currentCharacter)) {
-                ++readingIndex;
-                int value = parseNumber(code, readingIndex);
-
-                tokens.push_back(Token{
-                        TokenType::ADDRESS,
-                        lineFound,
-                        "",
-                        value,
-                        byteIndex
-                });
+                if (currentCharacter == '\n') {
+                    lineFound++;
+                }
+
+                if (isIgnorable(currentCharacter)) {
+                    continue;
+                } else if (isMarker(currentCharacter)) {
+                    ++readingIndex;
+                    StringRef value = parseWord(code, readingIndex);
+
+                    token = Token{
+                            TokenType::MARKER,
+                            lineFound,
+                            value,
+                            0
+                    };
+                } else if (isDivider(currentCharacter)) {
+                    token = Token{
+                            TokenType::DIVIDER,
+                            lineFound,
+                            ",",
+                            0
+                    };
+                } else if (isIdentifier(currentCharacter)) {
+                    StringRef value = parseWord(code, readingIndex);
+
+                    token = Token{
+                            TokenType::IDENTIFIER,
+                            lineFound,
+                            value,
+                            0
+                    };
+                } else if (isNumber(currentCharacter)) {
+                    int value = 0;
+                    found = readNumber(value);
+
+                    token = Token{
+                            TokenType::NUMBER,
+                            lineFound,
+                            "",
+                            value
+                    };
+                } else if (isAddress(currentCharacter)) {
+                    ++readingIndex;
+                    int value = 0;
+                    found = readNumber(value);
+
+                    token = Token{
+                            TokenType::ADDRESS,
+                            lineFound,
+                            "",
+                            value
+                    };
+                } else if (isString(currentCharacter)) {
+                    std::size_t quote = readingIndex;
+                    ++readingIndex;
+                    StringRef value = parseString(code, readingIndex);
 
-                byteIndex += 4;
-            } else if (isString(currentCharacter)) {
-                ++readingIndex;
-                std::string value = parseString(code, readingIndex);
+                    // the closing quote is in the code still to come
+                    if (partial && readingIndex >= code.size()) {
+                        readingIndex = quote;
+                        return false;
+                    }
 
-                tokens.push_back(Token{
-                        TokenType::STRING,
-                        lineFound,
-                        value,
-                        0,
-                        byteIndex
-                });
-            } else if (isComment(currentCharacter)) {
-                ++readingIndex;
-                ++lineFound;
+                    token = Token{
+                            TokenType::STRING,
+                            lineFound,
+                            value,
+                            0
+                    };
+                } else if (isComment(currentCharacter)) {
+                    ++readingIndex;
+                    ++lineFound;
 
-                while (readingIndex <= code.size() && code[readingIndex] != '\n') {
+                    while (readingIndex < code.size() && code[readingIndex] != '\n') {
+                        ++readingIndex;
+                    }
+
+                    found = false;
+                } else {
+                    fail("Unexpected symbol on line " + std::to_string(lineFound));
+                    found = false;
+                }
+
+                if (found) {
                     ++readingIndex;
+                    return true;
                 }
-            } else {
-                std::cout << termcolor::red << "[ERROR]" << termcolor::reset << " Unexpected symbol on"
-                          << termcolor::red << " line " << lineFound << termcolor::reset;
-                error = true;
             }
+
+            return false;
         }
 
-        if (error) {
-            std::cout << termcolor::red << "[ERROR]" << termcolor::reset << " Aborting due to errors while parsing\n";
-            std::exit(-1);
+        bool failed() const {
+            return error;
         }
 
-        return tokens;
-    }
+        // the code is a piece of a longer one, a string it leaves open is not lexed but left at position()
+        void expectMore(bool more) {
+            partial = more;
+        }
 
-    std::string stringifyToken(TokenType value) {
-        switch (value) {
-            case TokenType::IDENTIFIER:
-                return "identifier";
-            case TokenType::NUMBER:
-                return "number";
-            case TokenType::DIVIDER:
-                return "divider";
-            case TokenType::OPCODE:
-                return "opcode";
-            case TokenType::REGISTER:
-                return "register";
-            case TokenType::MARKER:
-                return "marker";
-            case TokenType::END:
-                return "end";
-            case TokenType::ADDRESS:
-                return "address";
-            case TokenType::STRING:
-                return "string";
-            default:
-                return "unknown";
+        std::size_t position() const {
+            return readingIndex;
         }
-    }
 
-    std::string stringifyTokenValue(Token t) {
-        if (t.type == TokenType::ADDRESS || t.type == TokenType::NUMBER)
-            return std::to_string(t.valNumeric);
-        else
-            return t.valString;
+        int line() const {
+            return lineFound;
+        }
+    };
+
+    void abortOnLexerErrors(const Lexer &lex) {
+        if (lex.failed())
+            abortAssembly("parsing", "\n");
     }
 
-    void printTokens(std::vector<Token> &tokens) {
-        int lineNumberMagnitude = std::floor(std::log10(tokens.back().lineFound));
-        int currentLineNumber = 0;
+    // the tokens reference the code, so it has to outlive them
+    std::vector<Token> lexer(const StringRef &code) {
+        std::vector<Token> tokens;
+        Lexer lex(code);
+        Token t;
 
-        for (auto &t: tokens) {
-            int currentMagnitude = lineNumberMagnitude - std::floor(std::log10(t.lineFound));
-            int tokenTypePadding = 8 - stringifyToken(t.type).size();
+        while (lex.next(t))
+            tokens.push_back(t);
 
-            if (t.lineFound != currentLineNumber) {
-                std::cout << "  " << t.lineFound;
+        abortOnLexerErrors(lex);
+
+        return tokens;
+    }
+
+    // lexes a source a chunk at a time as it is read, "-" being standard input that may still be being written. A
+    // chunk ends at the last line break read so far so no token is cut in two, except for strings, a string left
+    // open moves on to the next chunk
+    class ChunkedLexer {
+    private:
+        std::string fileName;
+        std::ifstream file;
+        std::string pending; // read but not lexed yet
+        std::size_t bytes = 0;
+        int line = 1;
+        bool error = false;
+        bool openString = false;
+        bool end = false;
+
+        bool read(char *buffer, std::size_t size, std::size_t &got) {
+            if (fileName == "-")
+                return readInput(buffer, size, got);
+
+            file.read(buffer, size);
+            got = file.gcount();
+
+            return !file.bad();
+        }
+
+    public:
+        // false if the file can't be opened
+        bool open(const std::string &_fileName) {
+            fileName = _fileName;
+
+            if (fileName == "-")
+                return true;
+
+            file.open(fileName, std::ios::binary);
+            return file.is_open();
+        }
+
+        // reads and lexes the next chunk into chunk, appending its tokens, which point into chunk. False once the
+        // source has ended
+        bool next(std::string &chunk, std::vector<Token> &tokens) {
+            char buffer[1 << 16];
+
+            while (!end) {
+                std::size_t got;
+
+                if (!read(buffer, sizeof(buffer), got)) {
+                    reportError(0, fileName == "-" ? "Could not read standard input"
+                                                   : "Could not read '" + fileName + "'");
+                    throw AssemblyError();
+                }
+
+                end = got == 0;
+                bytes += got;
+                pending.append(buffer, got);
+
+                // an open string can't be lexed before a quote arrives, trying anyway would copy it every time
+                if (openString && !end && !std::memchr(buffer, '\'', got) && !std::memchr(buffer, '"', got))
+                    continue;
+
+                std::size_t cut = end ? pending.size() : pending.rfind('\n') + 1;
+
+                if (cut == 0)
+                    continue;
+
+                chunk.assign(pending, 0, cut);
+                pending.erase(0, cut);
+
+                Lexer lex(StringRef(chunk), 0, line, false);
+                Token t;
+                lex.expectMore(!end);
+
+                while (lex.next(t))
+                    tokens.push_back(t);
+
+                error = error || lex.failed();
+                line = lex.line();
+
+                openString = lex.position() < chunk.size();
+
+                if (openString)
+                    pending.insert(0, chunk, lex.position(), std::string::npos);
+
+                return true;
+            }
+
+            return false;
+        }
+
+        bool failed() const {
+            return error;
+        }
+
+        // read so far
+        std::size_t size() const {
+            return bytes;
+        }
+    };
+
+    // lexes all of standard input while it is still being written, the tokens point into the chunks so they have to
+    // outlive them
+    std::vector<Token> lexInput(std::deque<std::string> &chunks, std::size_t &size) {
+        std::vector<Token> tokens;
+        ChunkedLexer input;
+        input.open("-");
+
+        // a deque never moves its strings, the tokens stay valid
+        chunks.emplace_back();
+
+        while (input.next(chunks.back(), tokens))
+            chunks.emplace_back();
+
+        chunks.pop_back();
+        size = input.size();
+
+        if (input.failed())
+            abortAssembly("parsing", "\n");
+
+        return tokens;
+    }
+
+    std::string stringifyToken(TokenType value) {
+        switch (value) {
+            case TokenType::IDENTIFIER:
+                return "identifier";
+            case TokenType::NUMBER:
+                return "number";
+            case TokenType::DIVIDER:
+                return "divider";
+            case TokenType::OPCODE:
+                return "opcode";
+            case TokenType::REGISTER:
+                return "register";
+            case TokenType::MARKER:
+                return "marker";
+            case TokenType::END:
+                return "end";
+            case TokenType::ADDRESS:
+                return "address";
+            case TokenType::STRING:
+                return "string";
+            default:
+                return "unknown";
+        }
+    }
+
+    std::string stringifyTokenValue(Token t) {
+        if (t.type == TokenType::ADDRESS || t.type == TokenType::NUMBER)
+            return std::to_string(t.valNumeric);
+        else
+            return t.valString.str();
+    }
+
+    void printTokens(std::vector<Token> &tokens) {
+        int lineNumberMagnitude = std::floor(std::log10(tokens.back().lineFound));
+        int currentLineNumber = 0;
+
+        for (auto &t: tokens) {
+            int currentMagnitude = lineNumberMagnitude - std::floor(std::log10(t.lineFound));
+            int tokenTypePadding = 8 - stringifyToken(t.type).size();
+
+            if (t.lineFound != currentLineNumber) {
+                console() << "  " << t.lineFound;
                 currentLineNumber = t.lineFound;
             } else {
-                std::cout << "  .";
+                console() << "  .";
             }
 
             for (int i = 0; i < currentMagnitude; i++) {
-                std::cout << " ";
+                console() << " ";
             }
 
             if (t.type == TokenType::ADDRESS || t.type == TokenType::NUMBER) {
-                std::cout
+                console()
                         << termcolor::blue << " | "
                         << termcolor::reset << stringifyToken(t.type)
                         << termcolor::blue << ": " << termcolor::reset;
 
                 for (int i = 0; i < tokenTypePadding; i++)
-                    std::cout << " ";
+                    console() << " ";
 
-                std::cout << t.valNumeric << "\n";
+                console() << t.valNumeric << "\n";
             } else {
-                std::cout
+                console()
                         << termcolor::blue << " | "
                         << termcolor::reset << stringifyToken(t.type) << termcolor::blue << ": " << termcolor::reset;
 
                 for (int i = 0; i < tokenTypePadding; i++)
-                    std::cout << " ";
+                    console() << " ";
+
+                console() << t.valString << "\n";
+            }
+        }
+    }
 
-                std::cout << t.valString << "\n";
+    void printInstructions(const std::vector<IRInstruction> &instructions) {
+        for (auto &instr: instructions) {
+            console() << "  " << instr.lineFound << termcolor::blue << " | " << termcolor::reset << instr.byteIndex
+                      << termcolor::blue << ": " << termcolor::reset << opcodeNames[instr.opcode];
+
+            for (int i = 0; i < instr.operandCount; i++) {
+                console() << (i == 0 ? " " : ", ");
+
+                if (instr.operandTypes[i] == TokenType::REGISTER)
+                    console() << static_cast<char>('a' + instr.operands[i]);
+                else if (instr.operandTypes[i] == TokenType::ADDRESS)
+                    console() << "&" << instr.operands[i];
+                else
+                    console() << instr.operands[i];
             }
+
+            console() << "\n";
         }
     }
 
@@ -413,17 +1172,17 @@ namespace CCA {
                 addrPaddingAmount = longestDefAddr - std::floor(std::log10(d.index));
             }
 
-            std::cout << termcolor::blue << "  name: " << termcolor::reset << d.name << ", ";
+            console() << termcolor::blue << "  name: " << termcolor::reset << d.name << ", ";
 
             for (int i = 0; i < namePaddingAmount; i++)
-                std::cout << " ";
+                console() << " ";
 
-            std::cout << termcolor::blue << "addr: " << termcolor::reset << d.index << ", ";
+            console() << termcolor::blue << "addr: " << termcolor::reset << d.index << ", ";
 
             for (int i = 0; i < addrPaddingAmount; i++)
-                std::cout << " ";
+                console() << " ";
 
-            std::cout << termcolor::blue << "str: " << termcolor::reset << "'" << d.value << "'"
+            console() << termcolor::blue << "str: " << termcolor::reset << "'" << d.value << "'"
                       << termcolor::blue << "\n" << termcolor::reset;
         }
     }
@@ -441,155 +1200,308 @@ namespace CCA {
 
         for (auto &m: markers) {
             int markerNamePadding = longestMarkerName - m.name.size();
-            std::cout << termcolor::blue << "  name: " << termcolor::reset << m.name << ", ";
+            console() << termcolor::blue << "  name: " << termcolor::reset << m.name << ", ";
 
             for (int i = 0; i < markerNamePadding; i++)
-                std::cout << " ";
+                console() << " ";
 
-            std::cout << termcolor::blue << "addr: " << termcolor::reset << m.byteIndex
+            console() << termcolor::blue << "addr: " << termcolor::reset << m.byteIndex
                       << termcolor::yellow << "\n" << termcolor::reset;
         }
     }
 
-    std::vector<Definition> parseDefinitions(std::vector<Token> &tokens) {
-        std::vector<Token> tempTokens;
-        int definitionMemoryIndex = 0;
-        std::vector<Definition> definitions;
+    // operand shapes are: none, X, or X, Y where X and Y are a register, number or address
+    const int SIGNATURE_COUNT = 13;
+    const int NO_SIGNATURE = -1;
+
+    int operandKind(TokenType type) {
+        switch (type) {
+            case TokenType::REGISTER:
+                return 0;
+            case TokenType::NUMBER:
+                return 1;
+            case TokenType::ADDRESS:
+                return 2;
+            default:
+                return -1;
+        }
+    }
+
+    // encodes the shape of an argument list as a small integer, NO_SIGNATURE if it is not a valid shape
+    int operandSignature(const TokenType *types, std::size_t count) {
+        if (count == 0)
+            return 0;
+
+        int first = operandKind(types[0]);
+
+        if (first < 0)
+            return NO_SIGNATURE;
+
+        if (count == 1)
+            return 1 + first;
+
+        if (count != 3 || types[1] != TokenType::DIVIDER)
+            return NO_SIGNATURE;
+
+        int second = operandKind(types[2]);
+
+        if (second < 0)
+            return NO_SIGNATURE;
+
+        return 4 + first * 3 + second;
+    }
+
+    // the argument tokens of an instruction as they are gathered
+    struct OperandShape {
+        TokenType types[3];
+        std::size_t size;
+
+        int signature() const {
+            return size > 3 ? NO_SIGNATURE : operandSignature(types, size);
+        }
+    };
+
+    // adds an argument token to instr, returns the operand index it went to or -1 if it is not an operand
+    int appendArgument(IRInstruction &instr, OperandShape &shape, const Token &t) {
+        // identifiers resolve to numbers
+        TokenType type = t.type == TokenType::IDENTIFIER ? TokenType::NUMBER : t.type;
+
+        if (shape.size < 3)
+            shape.types[shape.size] = type;
+        ++shape.size;
+
+        if (operandKind(type) < 0 || instr.operandCount == 2)
+            return -1;
+
+        instr.operandTypes[instr.operandCount] = type;
+        instr.operands[instr.operandCount] = t.valNumeric;
+
+        return instr.operandCount++;
+    }
+
+    std::string expectedOpcodeMessage(const Token &t) {
+        return "Expected opcode on line " + std::to_string(t.lineFound) + " got " + stringifyToken(t.type) + ": " +
+               stringifyTokenValue(t);
+    }
 
-        for (unsigned int i = 0; i < tokens.size(); i++) {
-            Token t = tokens[i];
+    void reportExpectedOpcode(const Token &t) {
+        reportError(t.lineFound, expectedOpcodeMessage(t), "\n");
+    }
+
+    void reportDuplicateSymbol(const Symbol &symbol, const Symbol &existing) {
+        reportError(symbol.lineFound, "'" + symbol.name.str() + "' on line " + std::to_string(symbol.lineFound) +
+                                      " is already defined on line " + std::to_string(existing.lineFound));
+    }
+
+    // decodes the escape sequences of a def string in one pass, appending the bytes to data. memchr
+    // skips from backslash to backslash, unknown escapes are kept as written
+    void decodeEscapes(const StringRef &value, std::vector<unsigned char> &data) {
+        const char *current = value.data;
+        const char *end = value.data + value.size();
+
+        while (current < end) {
+            const char *backslash = static_cast<const char *>(std::memchr(current, '\\', end - current));
+
+            if (!backslash) {
+                data.insert(data.end(), current, end);
+                break;
+            }
+
+            data.insert(data.end(), current, backslash);
+
+            if (backslash + 1 == end) {
+                data.push_back('\\');
+                break;
+            }
+
+            switch (backslash[1]) {
+                case 'n':
+                    data.push_back('\n');
+                    break;
+                case 't':
+                    data.push_back('\t');
+                    break;
+                case '\\':
+                    data.push_back('\\');
+                    break;
+                case '\'':
+                    data.push_back('\'');
+                    break;
+                case '"':
+                    data.push_back('"');
+                    break;
+                case 'a':
+                    data.push_back('\a');
+                    break;
+                case 'b':
+                    data.push_back('\b');
+                    break;
+                case 'e':
+                    data.push_back(0x1b);
+                    break;
+                case 'f':
+                    data.push_back('\f');
+                    break;
+                case 'r':
+                    data.push_back('\r');
+                    break;
+                case 'v':
+                    data.push_back('\v');
+                    break;
+                default:
+                    data.push_back('\\');
+                    data.push_back(backslash[1]);
+            }
+
+            current = backslash + 2;
+        }
+    }
+
+    // removes the def statements from the tokens, their decoded strings are laid out back to back in program.data
+    void parseDefinitions(std::vector<Token> &tokens, Program &program) {
+        std::size_t kept = 0;
+
+        for (std::size_t i = 0; i < tokens.size(); i++) {
+            const Token &t = tokens[i];
 
             if (t.type == TokenType::IDENTIFIER && t.valString == "def") {
-                if (tokens[i + 1].type != TokenType::IDENTIFIER || tokens[i + 2].type != TokenType::STRING) {
-                    std::cout << termcolor::red << "[ERROR]" << termcolor::reset
-                              << " Unknown syntax in definition statement on " << termcolor::red << " line "
-                              << t.lineFound << termcolor::reset;
-                    std::exit(-1);
+                if (i + 2 >= tokens.size() || tokens[i + 1].type != TokenType::IDENTIFIER ||
+                    tokens[i + 2].type != TokenType::STRING) {
+                    reportError(t.lineFound, "Unknown syntax in definition statement on  line " +
+                                             std::to_string(t.lineFound));
+                    throw AssemblyError();
                 }
 
-                definitions.push_back(Definition{
+                int definitionMemoryIndex = program.data.size();
+                decodeEscapes(tokens[i + 2].valString, program.data);
+
+                program.definitions.push_back(Definition{
                         definitionMemoryIndex,
                         tokens[i + 2].valString,
                         tokens[i + 1].valString
                 });
 
-                definitionMemoryIndex += tokens[i + 2].valString.size();
+                Symbol symbol = {tokens[i + 1].valString, SymbolType::DEFINITION, definitionMemoryIndex, t.lineFound};
+
+                if (const Symbol *existing = program.symbols.insert(symbol)) {
+                    reportDuplicateSymbol(symbol, *existing);
+                    throw AssemblyError();
+                }
 
                 i += 2;
-                continue;
             } else {
-                tempTokens.push_back(t);
+                tokens[kept++] = t;
             }
         }
 
-        tokens = tempTokens;
-
-        return definitions;
+        tokens.resize(kept);
     }
 
-    void postTokenizer(std::vector<Token> &tokens, std::vector<Marker> &markers, std::vector<Definition> &definitions) {
-        std::vector<Token> partialCopy = {};
-
-        for (unsigned int i = 0; i < tokens.size(); i++) {
-            Token &t = tokens[i];
+    // classifies the tokens, collects the markers and lowers every opcode and its arguments into an IRInstruction.
+    // identifiers used as operands are recorded in program.references and filled in by resolveSymbols
+    void postTokenizer(std::vector<Token> &tokens, Program &program) {
+        bool errors = false;
 
-            std::vector<std::string> opcodes = {"rand", "pow", "mod", "mov", "stp", "syscall", "push", "pop", "dup",
-                                                "add", "sub", "mul", "div", "not", "and", "or", "xor", "jmp", "je",
-                                                "jne", "jg", "js", "jo", "frs", "inc", "dec", "call", "ret", "cmp"};
-            std::vector<std::string> registers = {"a", "b", "c", "d"};
+        // the argument shape of the instruction being lowered
+        OperandShape shape = {};
 
-            // indentify the opcodes
-            if (t.type == TokenType::IDENTIFIER && in_array(t.valString, opcodes))
-                t.type = TokenType::OPCODE;
+        for (std::size_t i = 0; i < tokens.size(); i++) {
+            Token &t = tokens[i];
 
-            // identify the registers
-            if (t.type == TokenType::IDENTIFIER && in_array(t.valString, registers))
-                t.type = TokenType::REGISTER;
+            // indentify the opcodes and registers, valNumeric holds their id from now on
+            if (t.type == TokenType::IDENTIFIER)
+                t.type = classifyWord(t.valString, t.valNumeric);
 
             // markers
             if (t.type == TokenType::MARKER) {
-                markers.push_back(Marker{
+                unsigned int instruction = program.instructions.size();
+
+                program.markers.push_back(Marker{
                         t.valString,
-                        t.byteIndex
+                        0,
+                        instruction
                 });
 
-            } else {
-                partialCopy.push_back(t);
-            }
-        }
-
-        bool errors = false;
-
-        tokens = partialCopy;
+                // holds the instruction index until layoutInstructions knows the address
+                Symbol symbol = {t.valString, SymbolType::MARKER, static_cast<int>(instruction), t.lineFound};
 
-        for (unsigned int i = 0; i < tokens.size(); i++) {
-            Token &t = tokens[i];
-            if (t.type == TokenType::IDENTIFIER) {
-                t.type = TokenType::NUMBER;
+                if (const Symbol *existing = program.symbols.insert(symbol)) {
+                    reportDuplicateSymbol(symbol, *existing);
+                    errors = true;
+                }
 
-                bool found = false;
+                continue;
+            }
 
-                for (unsigned int j = 0; j < markers.size(); j++) {
-                    Marker &m = markers[j];
+            if (t.type == TokenType::OPCODE) {
+                if (!program.instructions.empty())
+                    program.instructions.back().signature = shape.signature();
 
-                    if (m.name == t.valString) {
-                        t.valNumeric = m.byteIndex;
-                        found = true;
-                        break;
-                    }
-                }
+                IRInstruction instr = {};
+                instr.opcode = t.valNumeric;
+                instr.lineFound = t.lineFound;
 
-                if (!found) { // HERE
-                    for (unsigned int j = 0; j < definitions.size(); j++) {
-                        Definition &d = definitions[j];
+                program.instructions.push_back(instr);
+                shape.size = 0;
+                continue;
+            }
 
-                        if (d.name == t.valString) {
-                            t.valNumeric = d.index;
-                            found = true;
-                            break;
-                        }
-                    }
-                }
+            // everything else is an argument, so there has to be an opcode before it
+            if (program.instructions.empty()) {
+                reportExpectedOpcode(t);
+                throw AssemblyError();
+            }
 
-                if (!found) {
-                    std::cout << termcolor::red << "[ERROR]" << termcolor::reset << " Could not match identifier '"
-                              << t.valString << "' on" << termcolor::red << " line " << t.lineFound << termcolor::reset
-                              << "\n\n";
-                    errors = true;
-                }
+            int operand = appendArgument(program.instructions.back(), shape, t);
 
-                tokens[i] = t;
+            if (operand >= 0 && t.type == TokenType::IDENTIFIER) {
+                program.references.push_back(SymbolReference{
+                        t.valString,
+                        t.lineFound,
+                        static_cast<unsigned int>(program.instructions.size() - 1),
+                        static_cast<unsigned int>(operand)
+                });
             }
         }
 
-        if (errors) {
-            std::cout << termcolor::red << "[ERROR]" << termcolor::reset
-                      << " Aborting due to errors while analyzing semantics\n\n";
-            std::exit(-1);
-        }
-
+        if (!program.instructions.empty())
+            program.instructions.back().signature = shape.signature();
 
+        if (errors)
+            abortAssembly("analyzing semantics");
     }
 
-    void pushRegister(std::vector<unsigned char> &bytecode, const Token &t) {
-        bytecode.push_back(t.valString[0] - 'a');
-    }
+    void resolveSymbols(Program &program) {
+        bool errors = false;
 
-    void pushNumeric(std::vector<unsigned char> &bytecode, const Token &t) {
-        for (int i = 0; i < 4; i++) {
-            unsigned char byte = (t.valNumeric >> (24 - 8 * i)) & 0xFF;
-            bytecode.push_back(byte);
+        for (auto &reference: program.references) {
+            const Symbol *symbol = program.symbols.find(reference.name);
+
+            if (symbol) {
+                program.instructions[reference.instruction].operands[reference.operand] = symbol->value;
+            } else {
+                reportError(reference.lineFound, "Could not match identifier '" + reference.name.str() + "' on line " +
+                                                 std::to_string(reference.lineFound));
+                errors = true;
+            }
         }
+
+        if (errors)
+            abortAssembly("analyzing semantics");
+    }
+
+    void pushRegister(std::vector<unsigned char> &bytecode, int value) {
+        bytecode.push_back(value);
     }
 
-    void pushLabel(std::vector<unsigned char> &bytecode, const Token &t) {
+    void pushNumeric(std::vector<unsigned char> &bytecode, int value) {
         for (int i = 0; i < 4; i++) {
-            unsigned char byte = (t.byteIndex >> (24 - 8 * i)) & 0xFF;
+            unsigned char byte = (value >> (24 - 8 * i)) & 0xFF;
             bytecode.push_back(byte);
         }
     }
 
-    std::map<std::string, std::vector<Instruction>> instructionSet = {
+    const std::map<std::string, std::vector<Instruction>> instructionSet = {
             {"stp",     {
                                 {0x00, {}}
                         }},
@@ -602,7 +1514,7 @@ namespace CCA {
                                 {0x05, {}}
                         }},
 
-            {"psh",     {
+            {"push",    {
                                 {0x01, {TokenType::NUMBER}},
                                 {0x02, {TokenType::REGISTER}},
                                 {0x0c, {TokenType::ADDRESS}}
@@ -756,218 +1668,2865 @@ namespace CCA {
                         }},
     };
 
-    void generateBytecode(std::vector<Definition> definitions, std::vector<Token> tokens, std::string fileName) {
-        std::vector<unsigned char> bytecode;
-
-        bool error = false;
+    // the size in bytes of an instruction with these arguments, including the opcode byte
+    int instructionSize(const Instruction &instr) {
+        int size = 1;
 
-        for (unsigned int i = 0; i < tokens.size(); i++) {
-            const Token &opcode = tokens[i];
+        for (auto arg: instr.args) {
+            if (arg == TokenType::REGISTER)
+                size += 1;
+            else if (arg == TokenType::NUMBER || arg == TokenType::ADDRESS)
+                size += 4;
+        }
 
-            // if not opcode, something must've gone wrong, error
-            if (opcode.type != TokenType::OPCODE) {
-                std::cout << termcolor::red << "[ERROR]" << termcolor::reset << " Expected opcode on line "
-                          << opcode.lineFound << " got " << stringifyToken(opcode.type) << ": "
-                          << stringifyTokenValue(opcode) << "\n";
-                std::exit(-1);
-            }
+        return size;
+    }
 
-            // find the instructions that this opcode could be part of
-            std::vector<Instruction> possibleInstructions = instructionSet[opcode.valString];
+    // instructionSet flattened into (opcode, operand signature) -> encoding and size, -1 and 0 where there is none
+    struct EncodingTable {
+        short encodings[static_cast<int>(Opcode::COUNT)][SIGNATURE_COUNT];
+        unsigned char sizes[static_cast<int>(Opcode::COUNT)][SIGNATURE_COUNT];
 
-            // gather the arguments given to this opcode, also keep in mind there could be no more arguments
-            std::vector<Token> arguments = {};
-            while (i < (tokens.size() - 1) && tokens[i + 1].type != TokenType::OPCODE)
-                arguments.push_back(tokens[++i]);
+        EncodingTable() {
+            for (auto &row: encodings) {
+                for (auto &encoding: row)
+                    encoding = -1;
+            }
 
-            Instruction matchingInstruction;
+            for (auto &row: sizes) {
+                for (auto &size: row)
+                    size = 0;
+            }
 
-            // find the instruction fitting with this opcode and arguments
-            for (int j = 0; j < possibleInstructions.size(); j++) {
-                // check every instruction
-                Instruction instr = possibleInstructions[j];
+            for (auto &entry: instructionSet) {
+                int id;
 
-                // they must be the same in size
-                if (arguments.size() != instr.args.size())
+                if (classifyWord(entry.first, id) != TokenType::OPCODE)
                     continue;
 
-                bool matching = true;
+                for (auto &instr: entry.second) {
+                    int signature = operandSignature(instr.args.data(), instr.args.size());
 
-                // they must be the matching in content
-                for (int k = 0; k < instr.args.size(); k++) {
-                    if (arguments[k].type != instr.args[k]) {
-                        matching = false;
-                        break;
+                    // like the lookup used to, the first listed variant wins
+                    if (signature != NO_SIGNATURE && encodings[id][signature] < 0) {
+                        encodings[id][signature] = instr.opcode;
+                        sizes[id][signature] = instructionSize(instr);
                     }
                 }
-
-                // if it was all matching
-                if (matching) {
-                    // this instruction must be the right one!
-                    matchingInstruction = instr;
-                    break;
-                }
             }
+        }
 
-            // add the opcode to the bytecode
-            bytecode.push_back(matchingInstruction.opcode);
-
-            // translate the arguments to bytecode and add them to the buffer
-            for (int j = 0; j < arguments.size(); j++) {
-                Token arg = arguments[j];
+        int find(int opcode, int signature) const {
+            if (signature == NO_SIGNATURE)
+                return -1;
 
-                switch (arg.type) {
-                    case TokenType::REGISTER:
-                        pushRegister(bytecode, arg);
-                        break;
-                    case TokenType::ADDRESS:
-                    case TokenType::NUMBER:
-                        pushNumeric(bytecode, arg);
-                }
-            }
+            return encodings[opcode][signature];
         }
 
-        if (error) {
-            std::cout << termcolor::red << "[ERROR]" << termcolor::reset
-                      << " Aborting due to errors while generating executable\n\n";
-            std::exit(-1);
-        }
+        int size(int opcode, int signature) const {
+            if (signature == NO_SIGNATURE)
+                return 0;
 
-        // Section Seperation Sequence
-        char SSS[4] = {0x1d, 0x1d, 0x1d, 0x1d};
+            return sizes[opcode][signature];
+        }
+    };
 
-        std::ofstream file;
-        file.open(fileName, std::ios::binary);
+    const EncodingTable encodingTable;
 
-        for (int i = 0; i < definitions.size(); i++) {
-            std::string s = definitions[i].value;
+    // gives every instruction its address using the size of its encoding, then points the markers at them
+    void layoutInstructions(Program &program) {
+        bool error = false;
+        int byteIndex = 0;
 
-            s = replace(s, "\\n", "\n");
-            s = replace(s, "\\t", "\t");
-            s = replace(s, "\\\\", "\\");
-            s = replace(s, "\\'", "'");
-            s = replace(s, "\\\"", "\"");
-            s = replace(s, "\\a", "\a");
-            s = replace(s, "\\b", "\b");
-            s = replace(s, "\\e", "\e");
-            s = replace(s, "\\f", "\f");
-            s = replace(s, "\\r", "\r");
-            s = replace(s, "\\v", "\v");
+        for (auto &instr: program.instructions) {
+            int size = encodingTable.size(instr.opcode, instr.signature);
 
-            if (s != "") {
-                file.write(s.c_str(), s.size());
+            if (size == 0) {
+                reportError(instr.lineFound, std::string("Invalid operands for '") + opcodeNames[instr.opcode] +
+                                             "' on line " + std::to_string(instr.lineFound));
+                error = true;
             }
+
+            instr.byteIndex = byteIndex;
+            byteIndex += size;
         }
 
-        file.write(SSS, 4);
+        if (error)
+            abortAssembly("generating executable");
 
-        std::string s(bytecode.begin(), bytecode.end());
-        file.write(s.c_str(), s.size());
+        // a marker after the last instruction points at the end of the code
+        for (auto &m: program.markers) {
+            m.byteIndex = m.instruction < program.instructions.size()
+                          ? program.instructions[m.instruction].byteIndex : byteIndex;
+        }
 
-        file.close();
+        for (auto &symbol: program.symbols) {
+            if (symbol.type != SymbolType::MARKER)
+                continue;
+
+            unsigned int instruction = symbol.value;
+            symbol.value = instruction < program.instructions.size()
+                           ? program.instructions[instruction].byteIndex : byteIndex;
+        }
     }
 
-    void assemble(std::string fileName, cxxopts::ParseResult result) {
-        auto begin = std::chrono::high_resolution_clock::now();
+    // the bytes writeBytecode writes, for callers that keep the image in memory
+    void appendImage(const std::vector<unsigned char> &data, const std::vector<unsigned char> &bytecode,
+                     std::vector<unsigned char> &image) {
+        const unsigned char SSS[4] = {0x1d, 0x1d, 0x1d, 0x1d};
 
-        uint8_t silent = result.count("silent");
-        uint8_t customOutName = 0;
+        image.reserve(image.size() + data.size() + 4 + bytecode.size());
+        image.insert(image.end(), data.begin(), data.end());
+        image.insert(image.end(), SSS, SSS + 4);
+        image.insert(image.end(), bytecode.begin(), bytecode.end());
+    }
 
-        std::string outputName = "";
+    // a piece of an output file, written as it is without copying it together first
+    struct OutputPiece {
+        const void *data;
+        std::size_t size;
+    };
 
-        if (result.count("output")) {
-            customOutName = 1;
-            outputName = result["output"].as<std::string>();
-        }
+    // outputs from this size on get their blocks reserved before they are written, in as few extents as the
+    // file system can find. Measured against writing them through a mapping of the reserved file, which faults
+    // every page in before copying into it and came out slower than the single writev
+    const std::size_t preallocatedOutputSize = 64 << 20;
 
-        if (!silent) {
-            std::cout << termcolor::green << "[INFO]" << termcolor::reset << " Parsing " << termcolor::green << fileName
-                      << termcolor::reset << "...\n\n";
-        }
+#ifdef CCA_HAS_MMAP
+    // one writev for all the pieces, repeated only for what a short write left over
+    bool writeGathered(int fd, const OutputPiece *pieces, std::size_t count) {
+        std::vector<iovec> vectors;
 
-        // read inputs
-        if (!customOutName) {
-            outputName = fileName.substr(0, fileName.find(".")) + ".ccb";
+        for (std::size_t i = 0; i < count; ++i) {
+            if (pieces[i].size)
+                vectors.push_back(iovec{const_cast<void *>(pieces[i].data), pieces[i].size});
         }
 
-        // tokenise
-        std::vector<Token> tokens = lexer(readFile(fileName));
+        std::size_t next = 0;
 
-        std::vector<Marker> markers = {};
+        while (next < vectors.size()) {
+            ssize_t written = writev(fd, vectors.data() + next, static_cast<int>(vectors.size() - next));
 
-        // filter out the definitions
-        std::vector<Definition> definitions = parseDefinitions(tokens);
-
-        // post tokenizer
-        postTokenizer(tokens, markers, definitions);
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
 
-        if (!silent) {
-            std::cout << termcolor::green << "[INFO]" << termcolor::reset << " Generating " << termcolor::green
-                      << outputName << termcolor::reset << "...\n\n";
-        }
+                return false;
+            }
 
-        if (result.count("debug")) {
-            // print the tokens for debug
-            std::cout << termcolor::blue << "[DEBUG]" << termcolor::reset << " Lexical analyzer result: \n";
-            printTokens(tokens);
-            std::cout << "\n";
+            // skip what was written, finishing a piece that was written in part
+            for (std::size_t left = written; left > 0;) {
+                std::size_t step = std::min(left, vectors[next].iov_len);
+                vectors[next].iov_base = static_cast<char *>(vectors[next].iov_base) + step;
+                vectors[next].iov_len -= step;
+                left -= step;
 
-            // print the definitions for debug
-            std::cout << termcolor::blue << "[DEBUG]" << termcolor::reset << " Definitions found: \n";
-            printDefs(definitions);
-            std::cout << "\n";
+                if (vectors[next].iov_len == 0)
+                    ++next;
+            }
 
-            // print the markers
-            std::cout << termcolor::blue << "[DEBUG]" << termcolor::reset << " Markers found: \n";
-            printMarkers(markers);
-            std::cout << "\n";
+            while (next < vectors.size() && vectors[next].iov_len == 0)
+                ++next;
         }
 
-        generateBytecode(definitions, tokens, outputName);
+        return true;
+    }
+#endif
 
-        auto end = std::chrono::high_resolution_clock::now();
+    // a hard link into the build cache, writing through it would change the cached copy too
+    void detachOutput(const std::string &fileName) {
+#ifdef CCA_HAS_MMAP
+        struct stat info;
 
-        if (!silent) {
-            std::cout << termcolor::green << "[INFO]" << termcolor::reset << " Successfully assembled "
-                      << termcolor::green << fileName << termcolor::reset << ", took " << termcolor::green
-                      << std::chrono::duration<double, std::milli>(end - begin).count() << termcolor::reset << "ms\n\n";
-        }
+        if (stat(fileName.c_str(), &info) == 0 && info.st_nlink > 1)
+            unlink(fileName.c_str());
+#endif
+    }
+
+    // replaces the contents of fileName with the pieces, "-" writes them to standard output. False if it couldn't
+    bool writeOutputFile(const std::string &fileName, const OutputPiece *pieces, std::size_t count) {
+#ifdef CCA_HAS_MMAP
+        if (fileName == "-")
+            return writeGathered(1, pieces, count);
+
+        detachOutput(fileName);
+
+        int fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+        if (fd < 0)
+            return false;
+
+#ifdef __linux__
+        std::size_t size = 0;
+
+        for (std::size_t i = 0; i < count; ++i)
+            size += pieces[i].size;
+
+        // only a hint, writing reports a full disk anyway
+        if (size >= preallocatedOutputSize)
+            posix_fallocate(fd, 0, size);
+#endif
+
+        bool written = writeGathered(fd, pieces, count);
+
+        return ::close(fd) == 0 && written;
+#else
+        if (fileName == "-") {
+            for (std::size_t i = 0; i < count; ++i)
+                std::cout.write(static_cast<const char *>(pieces[i].data), pieces[i].size);
+
+            return static_cast<bool>(std::cout.flush());
+        }
+
+        std::ofstream file(fileName, std::ios::binary);
+
+        for (std::size_t i = 0; i < count; ++i)
+            file.write(static_cast<const char *>(pieces[i].data), pieces[i].size);
+
+        file.close();
+        return static_cast<bool>(file);
+#endif
+    }
+
+    // the data section, then the code, with the Section Seperation Sequence in between
+    void writeBytecode(const std::string &fileName, const std::vector<unsigned char> &data,
+                       const std::vector<unsigned char> &bytecode) {
+        // Section Seperation Sequence
+        const char SSS[4] = {0x1d, 0x1d, 0x1d, 0x1d};
+
+        const OutputPiece pieces[3] = {{data.data(), data.size()}, {SSS, 4}, {bytecode.data(), bytecode.size()}};
+
+        if (!writeOutputFile(fileName, pieces, 3)) {
+            reportError(0, "Could not write '" + fileName + "'");
+            throw AssemblyError();
+        }
+    }
+
+    void encodeInstruction(const IRInstruction &instr, std::vector<unsigned char> &bytecode) {
+        // find the instruction fitting with this opcode and the shape of its arguments
+        int encoding = encodingTable.find(instr.opcode, instr.signature);
+
+        // add the opcode to the bytecode
+        bytecode.push_back(encoding);
+
+        // translate the arguments to bytecode and add them to the buffer
+        for (int j = 0; j < instr.operandCount; j++) {
+            if (instr.operandTypes[j] == TokenType::REGISTER)
+                pushRegister(bytecode, instr.operands[j]);
+            else
+                pushNumeric(bytecode, instr.operands[j]);
+        }
+    }
+
+    // where operand sits in the encoding of instr, registers take one byte, numbers and addresses four
+    int operandOffset(const IRInstruction &instr, unsigned int operand) {
+        return 1 + (operand == 1 ? (instr.operandTypes[0] == TokenType::REGISTER ? 1 : 4) : 0);
+    }
+
+    void generateBytecode(const Program &program, std::vector<unsigned char> &bytecode) {
+        bool error = false;
+
+        bytecode.reserve(program.instructions.empty() ? 0 : program.instructions.back().byteIndex + 9);
+
+        for (auto &instr: program.instructions) {
+            encodeInstruction(instr, bytecode);
+
+            // the markers were placed with the sizes from layoutInstructions, they have to agree
+            int size = bytecode.size() - instr.byteIndex;
+
+            if (size != encodingTable.size(instr.opcode, instr.signature)) {
+                reportError(instr.lineFound, std::string("Instruction '") + opcodeNames[instr.opcode] + "' on line " +
+                                             std::to_string(instr.lineFound) + " was sized " +
+                                             std::to_string(encodingTable.size(instr.opcode, instr.signature)) +
+                                             " bytes but encoded as " + std::to_string(size));
+                error = true;
+            }
+        }
+
+        if (error)
+            abortAssembly("generating executable");
+    }
+
+    // a 4 byte slot in the code waiting for the value of a symbol, the fixups of a symbol are chained
+    struct Fixup {
+        std::size_t offset;
+        int lineFound;
+        int next; // index of the next fixup in the chain, -1 ends it
+    };
+
+    void patchNumeric(std::vector<unsigned char> &bytecode, std::size_t offset, int value) {
+        for (int i = 0; i < 4; i++)
+            bytecode[offset + i] = (value >> (24 - 8 * i)) & 0xFF;
+    }
+
+    // the code of a streamed assembly, waiting in a temporary file until the data section that goes in front of it
+    // is complete. Code that is in the file already is patched on the way out
+    class CodeSpill {
+    private:
+        std::FILE *file = nullptr;
+        std::size_t length = 0;
+        std::vector<std::pair<std::size_t, int>> patches;
+
+    public:
+        CodeSpill() {}
+
+        CodeSpill(const CodeSpill &) = delete;
+
+        CodeSpill &operator=(const CodeSpill &) = delete;
+
+        ~CodeSpill() {
+            if (file)
+                std::fclose(file);
+        }
+
+        // next to the output, which needs the room as well, false if it can't be created
+        bool open(const std::string &outputName) {
+#ifdef CCA_HAS_MMAP
+            std::string directory = ".";
+
+            if (outputName == "-") {
+                const char *temporary = std::getenv("TMPDIR");
+                directory = temporary && *temporary ? temporary : "/tmp";
+            } else if (outputName.rfind('/') != std::string::npos) {
+                directory = outputName.substr(0, std::max<std::size_t>(outputName.rfind('/'), 1));
+            }
+
+            std::string name = directory + "/.cca-code-XXXXXX";
+            std::vector<char> path(name.begin(), name.end());
+            path.push_back('\0');
+
+            int fd = mkstemp(path.data());
+
+            if (fd < 0)
+                return false;
+
+            // gone with the process, however it ends
+            unlink(path.data());
+
+            file = fdopen(fd, "w+b");
+
+            if (!file)
+                ::close(fd);
+#else
+            file = std::tmpfile();
+#endif
+            return file != nullptr;
+        }
+
+        std::size_t size() const {
+            return length;
+        }
+
+        bool append(const std::vector<unsigned char> &code) {
+            length += code.size();
+            return code.empty() || std::fwrite(code.data(), 1, code.size(), file) == code.size();
+        }
+
+        void patch(std::size_t offset, int value) {
+            patches.push_back(std::make_pair(offset, value));
+        }
+
+        // writes the code to out with the patches applied
+        bool copyTo(std::FILE *out) {
+            std::sort(patches.begin(), patches.end());
+
+            if (std::fflush(file) != 0 || std::fseek(file, 0, SEEK_SET) != 0)
+                return false;
+
+            std::vector<unsigned char> block(1 << 20);
+            std::size_t first = 0; // the first patch that isn't applied completely
+
+            for (std::size_t begin = 0; begin < length; begin += block.size()) {
+                std::size_t size = std::min(block.size(), length - begin);
+
+                if (std::fread(block.data(), 1, size, file) != size)
+                    return false;
+
+                // a patch can start in the block before this one
+                for (std::size_t i = first; i < patches.size() && patches[i].first < begin + size; i++) {
+                    for (std::size_t j = 0; j < 4; j++) {
+                        std::size_t at = patches[i].first + j;
+
+                        if (at >= begin && at < begin + size)
+                            block[at - begin] = (patches[i].second >> (24 - 8 * j)) & 0xFF;
+                    }
+                }
+
+                while (first < patches.size() && patches[first].first + 4 <= begin + size)
+                    ++first;
+
+                if (std::fwrite(block.data(), 1, size, out) != size)
+                    return false;
+            }
+
+            return true;
+        }
+    };
+
+    // writeBytecode for a streamed assembly, the code is what is in spill followed by what is left in memory
+    void writeStreamedBytecode(const std::string &fileName, const std::vector<unsigned char> &data, CodeSpill &spill,
+                               const std::vector<unsigned char> &bytecode) {
+        // Section Seperation Sequence
+        const char SSS[4] = {0x1d, 0x1d, 0x1d, 0x1d};
+
+        if (fileName != "-")
+            detachOutput(fileName);
+
+        std::FILE *file = fileName == "-" ? stdout : std::fopen(fileName.c_str(), "wb");
+
+        bool written = file && std::fwrite(data.data(), 1, data.size(), file) == data.size() &&
+                       std::fwrite(SSS, 1, 4, file) == 4 && spill.copyTo(file) &&
+                       std::fwrite(bytecode.data(), 1, bytecode.size(), file) == bytecode.size();
+
+        if (file == stdout)
+            written = std::fflush(file) == 0 && written;
+        else if (file)
+            written = std::fclose(file) == 0 && written;
+
+        if (!written) {
+            reportError(0, "Could not write '" + fileName + "'");
+            throw AssemblyError();
+        }
+    }
+
+    // encodes every instruction as soon as it is lexed, without keeping the tokens or instructions around.
+    // identifiers that are not defined yet get a fixup which is patched once their marker or def shows up. The
+    // errors are held back until the end and reported like the multi-pass pipeline does, phase by phase
+    class OnePassAssembler {
+    private:
+        // a marker whose name was taken, existing is looked up when it is reported since a def further down takes
+        // the name before every marker in the multi-pass pipeline
+        struct DuplicateMarker {
+            Symbol symbol;
+            std::size_t ordinal;
+        };
+
+        // a marker after an instruction points past its arguments, which may still follow it
+        struct WaitingMarker {
+            std::string name;
+            int lineFound;
+            std::size_t ordinal;
+        };
+
+        SymbolTable symbols;
+
+        // the symbols own their names, the source can be gone before the end in a streamed assembly
+        std::deque<std::string> names;
+
+        std::vector<Fixup> fixups;
+        int freeFixups = -1; // chain of patched fixups that can be reused
+
+        // the instruction being gathered
+        IRInstruction instr;
+        OperandShape shape;
+        StringRef operandNames[2]; // the identifier of each operand, empty if it is not one
+        int operandLines[2]; // the line of each identifier, which can be after the opcode's
+        bool pending = false;
+
+        std::vector<WaitingMarker> waitingMarkers;
+
+        // the ordinal of the first marker of every name
+        SymbolTable markerOrdinals;
+        std::size_t markerCount = 0;
+
+        // the def statement being gathered, 1 while it waits for its name and 2 for its value
+        int definitionPart = 0;
+        Token definition;
+        Token definitionName;
+
+        // copies of the names above once the chunk they came from is gone
+        std::string carried[3];
+
+        // the code before bytecode, moved to spill already
+        CodeSpill *spill = nullptr;
+        std::size_t codeBase = 0;
+
+        // the errors by the phase of the multi-pass pipeline that finds them: the first bad def, the markers and
+        // the argument before any opcode, the invalid operands. The unresolved identifiers are left in the fixups
+        bool badDefinition = false;
+        Diagnostic definitionError;
+        std::vector<DuplicateMarker> duplicateMarkers;
+        bool missingOpcode = false;
+        Diagnostic missingOpcodeError;
+        std::vector<Diagnostic> operandErrors;
+
+        std::size_t tokenCount = 0;
+        std::size_t instructionCount = 0;
+
+        int addFixup(std::size_t offset, int lineFound, int next) {
+            if (freeFixups < 0) {
+                fixups.push_back(Fixup{offset, lineFound, next});
+                return fixups.size() - 1;
+            }
+
+            int index = freeFixups;
+            freeFixups = fixups[index].next;
+            fixups[index] = Fixup{offset, lineFound, next};
+
+            return index;
+        }
+
+        static Diagnostic makeDiagnostic(int line, const std::string &message) {
+            Diagnostic diagnostic;
+            diagnostic.line = line;
+            diagnostic.message = message;
+            return diagnostic;
+        }
+
+        // only the first one counts, parseDefinitions stops there
+        void failDefinition(int lineFound, const std::string &message) {
+            if (badDefinition)
+                return;
+
+            badDefinition = true;
+            definitionError = makeDiagnostic(lineFound, message);
+        }
+
+        void failBadSyntax() {
+            failDefinition(definition.lineFound, "Unknown syntax in definition statement on  line " +
+                                                 std::to_string(definition.lineFound));
+        }
+
+        StringRef own(const StringRef &name) {
+            names.push_back(name.str());
+            return StringRef(names.back());
+        }
+
+        std::size_t position() const {
+            return codeBase + bytecode.size();
+        }
+
+        void patch(std::size_t offset, int value) {
+            if (offset >= codeBase)
+                patchNumeric(bytecode, offset - codeBase, value);
+            else
+                spill->patch(offset, value);
+        }
+
+        // gives the symbol its value, patching every use so far, symbol is new or unresolved
+        void resolve(Symbol *existing, const Symbol &symbol) {
+            if (!existing) {
+                Symbol owned = symbol;
+                owned.name = own(symbol.name);
+                symbols.insert(owned);
+                return;
+            }
+
+            int i = existing->type == SymbolType::UNRESOLVED ? existing->value : -1;
+
+            // hand the fixups back
+            while (i >= 0) {
+                patch(fixups[i].offset, symbol.value);
+
+                int next = fixups[i].next;
+                fixups[i].next = freeFixups;
+                freeFixups = i;
+                i = next;
+            }
+
+            existing->type = symbol.type;
+            existing->value = symbol.value;
+            existing->lineFound = symbol.lineFound;
+        }
+
+        void defineMarker(const StringRef &name, int lineFound, std::size_t ordinal) {
+            Symbol *existing = symbols.find(name);
+            Symbol symbol = {name, SymbolType::MARKER, static_cast<int>(position()), lineFound};
+
+            if (existing && existing->type != SymbolType::UNRESOLVED) {
+                symbol.name = existing->name;
+                duplicateMarkers.push_back(DuplicateMarker{symbol, ordinal});
+                return;
+            }
+
+            resolve(existing, symbol);
+            markerOrdinals.insert(Symbol{symbols.find(name)->name, SymbolType::MARKER, static_cast<int>(ordinal),
+                                         lineFound});
+        }
+
+        void defineDefinition(const Symbol &symbol) {
+            Symbol *existing = symbols.find(symbol.name);
+
+            if (existing && existing->type == SymbolType::DEFINITION) {
+                failDefinition(symbol.lineFound, "'" + symbol.name.str() + "' on line " +
+                                                 std::to_string(symbol.lineFound) + " is already defined on line " +
+                                                 std::to_string(existing->lineFound));
+                return;
+            }
+
+            // the defs are collected before the markers, so the marker that came first is the duplicate
+            if (existing && existing->type == SymbolType::MARKER) {
+                const Symbol *ordinal = markerOrdinals.find(existing->name);
+                duplicateMarkers.push_back(DuplicateMarker{*existing, static_cast<std::size_t>(ordinal->value)});
+            }
+
+            resolve(existing, symbol);
+        }
+
+        // the value of the symbol, or 0 and a fixup at offset if it is not defined yet
+        int reference(const StringRef &name, int lineFound, std::size_t offset) {
+            Symbol *symbol = symbols.find(name);
+
+            if (!symbol) {
+                symbols.insert(Symbol{own(name), SymbolType::UNRESOLVED, addFixup(offset, lineFound, -1), lineFound});
+            } else if (symbol->type == SymbolType::UNRESOLVED) {
+                symbol->value = addFixup(offset, lineFound, symbol->value);
+            } else {
+                return symbol->value;
+            }
+
+            return 0;
+        }
+
+        void flush() {
+            if (!pending)
+                return;
+
+            pending = false;
+
+            int encoding = encodingTable.find(instr.opcode, shape.signature());
+
+            if (encoding < 0) {
+                operandErrors.push_back(makeDiagnostic(instr.lineFound, std::string("Invalid operands for '") +
+                                                                        opcodeNames[instr.opcode] + "' on line " +
+                                                                        std::to_string(instr.lineFound)));
+            } else {
+                bytecode.push_back(encoding);
+                ++instructionCount;
+
+                for (int j = 0; j < instr.operandCount; j++) {
+                    if (instr.operandTypes[j] == TokenType::REGISTER) {
+                        pushRegister(bytecode, instr.operands[j]);
+                        continue;
+                    }
+
+                    if (!operandNames[j].empty())
+                        instr.operands[j] = reference(operandNames[j], operandLines[j], position());
+
+                    pushNumeric(bytecode, instr.operands[j]);
+                }
+            }
+
+            for (const WaitingMarker &marker: waitingMarkers)
+                defineMarker(StringRef(marker.name), marker.lineFound, marker.ordinal);
+
+            waitingMarkers.clear();
+        }
+
+    public:
+        std::vector<unsigned char> data;
+        std::vector<unsigned char> bytecode;
+
+        // takes the tokens of the source in order
+        void feed(Token t) {
+            ++tokenCount;
+
+            if (definitionPart == 1) {
+                definitionName = t;
+                definitionPart = 2;
+                return;
+            }
+
+            if (definitionPart == 2) {
+                definitionPart = 0;
+
+                if (definitionName.type != TokenType::IDENTIFIER || t.type != TokenType::STRING) {
+                    failBadSyntax();
+                    return;
+                }
+
+                int definitionMemoryIndex = data.size();
+                decodeEscapes(t.valString, data);
+
+                defineDefinition(Symbol{definitionName.valString, SymbolType::DEFINITION, definitionMemoryIndex,
+                                        definition.lineFound});
+                return;
+            }
+
+            if (t.type == TokenType::IDENTIFIER && t.valString == "def") {
+                definition = t;
+                definitionPart = 1;
+                return;
+            }
+
+            // postTokenizer stops at an argument before any opcode, the defs after it are still checked
+            if (missingOpcode)
+                return;
+
+            if (t.type == TokenType::IDENTIFIER)
+                t.type = classifyWord(t.valString, t.valNumeric);
+
+            if (t.type == TokenType::MARKER) {
+                if (pending)
+                    waitingMarkers.push_back(WaitingMarker{t.valString.str(), t.lineFound, markerCount++});
+                else
+                    defineMarker(t.valString, t.lineFound, markerCount++);
+
+                return;
+            }
+
+            if (t.type == TokenType::OPCODE) {
+                flush();
+
+                instr = IRInstruction{};
+                instr.opcode = t.valNumeric;
+                instr.lineFound = t.lineFound;
+                shape.size = 0;
+                operandNames[0] = operandNames[1] = StringRef();
+                pending = true;
+                return;
+            }
+
+            if (!pending) {
+                missingOpcode = true;
+                missingOpcodeError = makeDiagnostic(t.lineFound, expectedOpcodeMessage(t));
+                return;
+            }
+
+            int operand = appendArgument(instr, shape, t);
+
+            if (operand >= 0 && t.type == TokenType::IDENTIFIER) {
+                operandNames[operand] = t.valString;
+                operandLines[operand] = t.lineFound;
+            }
+        }
+
+        // the code from now on is written to spill whenever a chunk ends with enough of it
+        void spillTo(CodeSpill *_spill) {
+            spill = _spill;
+        }
+
+        // the tokens fed so far may point into a chunk that is about to be reused
+        void endChunk() {
+            StringRef *held[3] = {&operandNames[0], &operandNames[1], &definitionName.valString};
+            bool used[3] = {pending, pending, definitionPart == 2};
+
+            for (int i = 0; i < 3; i++) {
+                if (!used[i] || held[i]->empty())
+                    continue;
+
+                carried[i] = held[i]->str();
+                *held[i] = StringRef(carried[i]);
+            }
+
+            if (spill && bytecode.size() >= (1 << 20)) {
+                if (!spill->append(bytecode)) {
+                    reportError(0, "Could not write the code to a temporary file");
+                    throw AssemblyError();
+                }
+
+                codeBase += bytecode.size();
+                bytecode.clear();
+            }
+        }
+
+        // the source ended, lexerFailed if its lexer reported errors. Reports what the phases of the multi-pass
+        // pipeline would, stopping where it would stop
+        void finish(bool lexerFailed) {
+            if (definitionPart != 0)
+                failBadSyntax();
+
+            flush();
+
+            if (lexerFailed)
+                abortAssembly("parsing", "\n");
+
+            if (badDefinition) {
+                reportError(definitionError.line, definitionError.message);
+                throw AssemblyError();
+            }
+
+            std::stable_sort(duplicateMarkers.begin(), duplicateMarkers.end(),
+                             [](const DuplicateMarker &a, const DuplicateMarker &b) { return a.ordinal < b.ordinal; });
+
+            for (const DuplicateMarker &duplicate: duplicateMarkers)
+                reportDuplicateSymbol(duplicate.symbol, *symbols.find(duplicate.symbol.name));
+
+            if (missingOpcode) {
+                reportError(missingOpcodeError.line, missingOpcodeError.message, "\n");
+                throw AssemblyError();
+            }
+
+            if (!duplicateMarkers.empty())
+                abortAssembly("analyzing semantics");
+
+            for (const Diagnostic &error: operandErrors)
+                reportError(error.line, error.message);
+
+            if (!operandErrors.empty())
+                abortAssembly("generating executable");
+
+            // in the order of the references, which is the order of their offsets
+            std::vector<std::pair<std::size_t, Diagnostic>> unresolved;
+
+            for (auto &symbol: symbols) {
+                if (symbol.type != SymbolType::UNRESOLVED)
+                    continue;
+
+                for (int i = symbol.value; i >= 0; i = fixups[i].next) {
+                    unresolved.push_back(std::make_pair(fixups[i].offset, makeDiagnostic(
+                            fixups[i].lineFound, "Could not match identifier '" + symbol.name.str() + "' on line " +
+                                                 std::to_string(fixups[i].lineFound))));
+                }
+            }
+
+            std::sort(unresolved.begin(), unresolved.end(),
+                      [](const std::pair<std::size_t, Diagnostic> &a, const std::pair<std::size_t, Diagnostic> &b) {
+                          return a.first < b.first;
+                      });
+
+            for (auto &error: unresolved)
+                reportError(error.second.line, error.second.message);
+
+            if (!unresolved.empty())
+                abortAssembly("analyzing semantics");
+        }
+
+        void run(const StringRef &code) {
+            Lexer lex(code);
+            Token t;
+
+            while (lex.next(t))
+                feed(t);
+
+            finish(lex.failed());
+        }
+
+        void count(AssemblyCounts &counts) const {
+            counts.tokens = tokenCount;
+            counts.instructions = instructionCount;
+            counts.symbols = symbols.size();
+            counts.dataBytes = data.size();
+            counts.codeBytes = position();
+        }
+    };
+
+    // stops an assembly between phases once cancelled has been set
+    void checkCancelled(const std::atomic<bool> *cancelled) {
+        if (cancelled && *cancelled)
+            throw AssemblyCancelled();
+    }
+
+    // --stream, a one pass assembly that reads the source a chunk at a time and keeps the code in a temporary file
+    // until the data section in front of it is complete. What stays in memory is the symbols, the fixups and the
+    // data section, however large the source is
+    void streamAssembly(const std::string &fileName, const std::string &outputName, bool silent, PhaseTimer &timer,
+                        AssemblyCounts &counts, const std::atomic<bool> *cancelled = nullptr) {
+        ChunkedLexer input;
+
+        if (!input.open(fileName)) {
+            reportError(0, "Could not open file '" + fileName + "', are you sure it exists?");
+            throw AssemblyError();
+        }
+
+        CodeSpill spill;
+
+        if (!spill.open(outputName)) {
+            reportError(0, "Could not create a temporary file for the code of '" + outputName + "'");
+            throw AssemblyError();
+        }
+
+        OnePassAssembler onePass;
+        onePass.spillTo(&spill);
+
+        std::string chunk;
+        std::vector<Token> tokens;
+
+        while (input.next(chunk, tokens)) {
+            for (const Token &t: tokens)
+                onePass.feed(t);
+
+            tokens.clear();
+            onePass.endChunk();
+            checkCancelled(cancelled);
+        }
+
+        onePass.finish(input.failed());
+        onePass.count(counts);
+
+        counts.sourceBytes = input.size();
+        timer.lap("assemble", counts.sourceBytes);
+
+        if (!silent) {
+            console() << termcolor::green << "[INFO]" << termcolor::reset << " Generating " << termcolor::green
+                      << outputName << termcolor::reset << "...\n\n";
+        }
+
+        writeStreamedBytecode(outputName, onePass.data, spill, onePass.bytecode);
+        timer.lap("write", counts.dataBytes + 4 + counts.codeBytes);
+    }
+
+    // keeps everything a build produced, so the next build of the same file only lexes, lowers and encodes the
+    // statements an edit touched. Edits it can't patch, like ones that add or remove markers or defs, or that
+    // don't assemble, are built from scratch
+    class IncrementalAssembler {
+    private:
+        // a marker or def statement in the source, line is the line the lexer is on after it. Arguments right
+        // after one still belong to the instruction in front of it
+        struct Span {
+            std::size_t begin;
+            std::size_t end;
+            int line;
+            bool argumentsAfter;
+        };
+
+        std::string source;
+        Program program;
+        std::vector<unsigned char> bytecode;
+        std::size_t tokenCount = 0;
+        bool warm = false;
+
+        // where the opcode of every instruction starts, and the marker and def statements, in source order
+        std::vector<std::size_t> instructionOffsets;
+        std::vector<Span> markerSpans;
+        std::vector<Span> definitionSpans;
+
+        // the symbols of the markers, defs and references, the table isn't touched until the next full build
+        std::vector<Symbol *> markerSymbols;
+        std::vector<Symbol *> definitionSymbols;
+        std::vector<Symbol *> referenceSymbols;
+
+        // what the output file is missing, in bytes of code
+        bool rewrite = true;
+        bool resized = false;
+        std::size_t dirtyBegin = 0;
+        std::size_t dirtyEnd = 0;
+
+        std::string writtenName;
+        std::size_t writtenSize = 0;
+
+        std::size_t offset(const StringRef &ref) const {
+            return ref.data - source.data();
+        }
+
+        static bool spanBefore(const Span &span, std::size_t offset) {
+            return span.begin < offset;
+        }
+
+        static bool spanEndsBefore(const Span &span, std::size_t offset) {
+            return span.end < offset;
+        }
+
+        // the index of the span starting at offset, or -1
+        static int spanAt(const std::vector<Span> &spans, std::size_t offset) {
+            auto span = std::lower_bound(spans.begin(), spans.end(), offset, spanBefore);
+
+            return span != spans.end() && span->begin == offset ? span - spans.begin() : -1;
+        }
+
+        // true if a statement of the current source starts at offset, line receives the line it is on
+        bool statementAt(std::size_t offset, int &line) const {
+            auto instruction = std::lower_bound(instructionOffsets.begin(), instructionOffsets.end(), offset);
+
+            if (instruction != instructionOffsets.end() && *instruction == offset) {
+                line = program.instructions[instruction - instructionOffsets.begin()].lineFound;
+                return true;
+            }
+
+            // lexing can only fall in step at a marker or def if what follows doesn't depend on what came before
+            int marker = spanAt(markerSpans, offset);
+
+            if (marker >= 0 && !markerSpans[marker].argumentsAfter) {
+                line = markerSymbols[marker]->lineFound;
+                return true;
+            }
+
+            int definition = spanAt(definitionSpans, offset);
+
+            if (definition >= 0 && !definitionSpans[definition].argumentsAfter) {
+                line = definitionSymbols[definition]->lineFound;
+                return true;
+            }
+
+            return false;
+        }
+
+        void markDirty(std::size_t begin, std::size_t end) {
+            if (dirtyBegin == dirtyEnd) {
+                dirtyBegin = begin;
+                dirtyEnd = end;
+            } else {
+                dirtyBegin = std::min(dirtyBegin, begin);
+                dirtyEnd = std::max(dirtyEnd, end);
+            }
+        }
+
+        void build(PhaseTimer &timer, const std::atomic<bool> *cancelled) {
+            warm = false;
+            program = Program();
+            bytecode.clear();
+            instructionOffsets.clear();
+            markerSpans.clear();
+            definitionSpans.clear();
+
+            std::vector<Token> tokens = lexer(source);
+
+            tokenCount = tokens.size();
+            timer.lap("lex", source.size());
+            checkCancelled(cancelled);
+
+            // the marker and def statements, before parseDefinitions drops the defs. The ones waiting to see if an
+            // instruction or an argument comes after them are pending
+            std::vector<std::size_t> pendingMarkers;
+            std::vector<std::size_t> pendingDefinitions;
+
+            for (std::size_t i = 0; i < tokens.size(); i++) {
+                const StringRef &value = tokens[i].valString;
+
+                if (tokens[i].type == TokenType::MARKER) {
+                    pendingMarkers.push_back(markerSpans.size());
+                    markerSpans.push_back(Span{offset(value) - 1, offset(value) + value.size(), tokens[i].lineFound,
+                                               false});
+                } else if (i + 2 < tokens.size() && tokens[i].type == TokenType::IDENTIFIER && value == "def" &&
+                           tokens[i + 1].type == TokenType::IDENTIFIER && tokens[i + 2].type == TokenType::STRING) {
+                    const StringRef &string = tokens[i + 2].valString;
+
+                    pendingDefinitions.push_back(definitionSpans.size());
+                    definitionSpans.push_back(Span{offset(value),
+                                                   std::min(offset(string) + string.size() + 1, source.size()),
+                                                   tokens[i + 2].lineFound, false});
+                    i += 2;
+                } else if (!pendingMarkers.empty() || !pendingDefinitions.empty()) {
+                    int id;
+                    bool argument = tokens[i].type != TokenType::IDENTIFIER ||
+                                    classifyWord(value, id) != TokenType::OPCODE;
+
+                    for (auto marker: pendingMarkers)
+                        markerSpans[marker].argumentsAfter = argument;
+
+                    for (auto definition: pendingDefinitions)
+                        definitionSpans[definition].argumentsAfter = argument;
+
+                    pendingMarkers.clear();
+                    pendingDefinitions.clear();
+                }
+            }
+
+            parseDefinitions(tokens, program);
+            timer.lap("definitions", source.size());
+            checkCancelled(cancelled);
+
+            postTokenizer(tokens, program);
+
+            for (auto &t: tokens) {
+                if (t.type == TokenType::OPCODE)
+                    instructionOffsets.push_back(offset(t.valString));
+            }
+
+            timer.lap("lowering", source.size());
+            checkCancelled(cancelled);
+
+            layoutInstructions(program);
+            timer.lap("layout", source.size());
+            checkCancelled(cancelled);
+
+            resolveSymbols(program);
+            timer.lap("resolve", source.size());
+            checkCancelled(cancelled);
+
+            generateBytecode(program, bytecode);
+            timer.lap("encode", bytecode.size());
+
+            markerSymbols.clear();
+            definitionSymbols.clear();
+            referenceSymbols.clear();
+
+            for (auto &m: program.markers)
+                markerSymbols.push_back(program.symbols.find(m.name));
+
+            for (auto &d: program.definitions)
+                definitionSymbols.push_back(program.symbols.find(d.name));
+
+            for (auto &reference: program.references)
+                referenceSymbols.push_back(program.symbols.find(reference.name));
+
+            rewrite = true;
+            warm = true;
+        }
+
+        // memcmp in blocks first, a byte loop over a whole source would take longer than the patch
+        static std::size_t commonPrefix(const char *a, const char *b, std::size_t length) {
+            std::size_t i = 0;
+
+            while (i + 4096 <= length && std::memcmp(a + i, b + i, 4096) == 0)
+                i += 4096;
+
+            while (i < length && a[i] == b[i])
+                ++i;
+
+            return i;
+        }
+
+        // the same from the ends backwards, aEnd and bEnd point past the last byte
+        static std::size_t commonSuffix(const char *aEnd, const char *bEnd, std::size_t length) {
+            std::size_t i = 0;
+
+            while (i + 4096 <= length && std::memcmp(aEnd - i - 4096, bEnd - i - 4096, 4096) == 0)
+                i += 4096;
+
+            while (i < length &&
+                   aEnd[-1 - static_cast<std::ptrdiff_t>(i)] == bEnd[-1 - static_cast<std::ptrdiff_t>(i)])
+                ++i;
+
+            return i;
+        }
+
+        // brings the previous build up to date with next by redoing the statements between the last statement
+        // boundary in front of the edit and the point where lexing the new source falls back in step with the
+        // old one. Returns false, with nothing changed, if the edit can't be patched
+        bool patch(std::string &next) {
+            if (!warm)
+                return false;
+
+            std::size_t oldSize = source.size();
+            std::size_t newSize = next.size();
+            std::size_t shorter = std::min(oldSize, newSize);
+
+            std::size_t prefix = commonPrefix(source.data(), next.data(), shorter);
+
+            if (prefix == oldSize && prefix == newSize)
+                return true;
+
+            std::size_t suffix = commonSuffix(source.data() + oldSize, next.data() + newSize, shorter - prefix);
+
+            std::ptrdiff_t delta = static_cast<std::ptrdiff_t>(newSize) - static_cast<std::ptrdiff_t>(oldSize);
+
+            // the last instruction start, marker end or def end in front of the edit, the lexer is between
+            // statements there and everything before it stays as it is
+            std::size_t start = 0;
+            int line = 1;
+
+            auto instruction = std::lower_bound(instructionOffsets.begin(), instructionOffsets.end(), prefix);
+
+            if (instruction != instructionOffsets.begin()) {
+                start = *(instruction - 1);
+                line = program.instructions[instruction - instructionOffsets.begin() - 1].lineFound;
+            }
+
+            for (auto spans: {&markerSpans, &definitionSpans}) {
+                auto span = std::lower_bound(spans->begin(), spans->end(), prefix, spanEndsBefore);
+
+                if (span != spans->begin() && (span - 1)->end > start && !(span - 1)->argumentsAfter) {
+                    start = (span - 1)->end;
+                    line = (span - 1)->line;
+                }
+            }
+
+            // lex the new source until a statement starts where one started in the old source past the edit,
+            // from there on both lex the same
+            Lexer lex(StringRef(next.data(), next.size()), start, line, true);
+            std::vector<Token> tokens;
+            std::size_t stop = oldSize; // in the old source
+            int lineDelta = 0;
+            Token t;
+
+            while (lex.next(t)) {
+                int id;
+                bool opcode = t.type == TokenType::IDENTIFIER && classifyWord(t.valString, id) == TokenType::OPCODE;
+                bool definition = t.type == TokenType::IDENTIFIER && t.valString == "def";
+
+                if (opcode || definition || t.type == TokenType::MARKER) {
+                    std::size_t at = t.valString.data - next.data() - (t.type == TokenType::MARKER ? 1 : 0);
+                    int oldLine;
+
+                    if (at >= newSize - suffix && statementAt(at - delta, oldLine)) {
+                        stop = at - delta;
+                        lineDelta = t.lineFound - oldLine;
+                        break;
+                    }
+
+                    // markers and defs change the symbols, that takes a full build
+                    if (!opcode)
+                        return false;
+                }
+
+                if (t.type == TokenType::STRING || (tokens.empty() && !opcode))
+                    return false;
+
+                tokens.push_back(t);
+            }
+
+            if (lex.failed())
+                return false;
+
+            // the old statements being replaced have to be instructions as well
+            auto markersAfter = std::lower_bound(markerSpans.begin(), markerSpans.end(), start, spanBefore);
+            auto definitionsAfter = std::lower_bound(definitionSpans.begin(), definitionSpans.end(), start,
+                                                     spanBefore);
+
+            if ((markersAfter != markerSpans.end() && markersAfter->begin < stop) ||
+                (definitionsAfter != definitionSpans.end() && definitionsAfter->begin < stop))
+                return false;
+
+            std::size_t first = std::lower_bound(instructionOffsets.begin(), instructionOffsets.end(), start) -
+                                instructionOffsets.begin();
+            std::size_t last = std::lower_bound(instructionOffsets.begin(), instructionOffsets.end(), stop) -
+                               instructionOffsets.begin();
+
+            Program region;
+            postTokenizer(tokens, region);
+
+            std::vector<Symbol *> regionSymbols;
+
+            for (auto &instr: region.instructions) {
+                if (encodingTable.size(instr.opcode, instr.signature) == 0)
+                    return false;
+            }
+
+            for (auto &reference: region.references) {
+                Symbol *symbol = program.symbols.find(reference.name);
+
+                if (!symbol)
+                    return false;
+
+                regionSymbols.push_back(symbol);
+            }
+
+            // the tokens of the statements being replaced, for the counts
+            Lexer old(StringRef(source.data(), stop), start, line, true);
+            std::size_t oldTokens = 0;
+
+            while (old.next(t))
+                ++oldTokens;
+
+            // nothing can fail from here on
+            std::vector<IRInstruction> &instructions = program.instructions;
+            std::vector<SymbolReference> &references = program.references;
+
+            std::size_t oldBegin = first < instructions.size() ? instructions[first].byteIndex : bytecode.size();
+            std::size_t oldEnd = last < instructions.size() ? instructions[last].byteIndex : bytecode.size();
+
+            std::size_t byteIndex = oldBegin;
+
+            for (auto &instr: region.instructions) {
+                instr.byteIndex = byteIndex;
+                byteIndex += encodingTable.size(instr.opcode, instr.signature);
+            }
+
+            int byteDelta = static_cast<int>(byteIndex) - static_cast<int>(oldEnd);
+            int instructionDelta = static_cast<int>(region.instructions.size()) - static_cast<int>(last - first);
+
+            // everything after the edit moves, the names point into the new source from now on
+            const char *oldBase = source.data();
+            const char *newBase = next.data();
+
+            auto rebase = [&](StringRef &name) {
+                std::size_t at = name.data - oldBase;
+                name.data = newBase + (at >= stop ? at + delta : at);
+            };
+
+            for (auto &symbol: program.symbols)
+                rebase(symbol.name);
+
+            for (std::size_t i = 0; i < markerSpans.size(); i++) {
+                rebase(program.markers[i].name);
+
+                if (markerSpans[i].begin >= stop) {
+                    markerSpans[i].begin += delta;
+                    markerSpans[i].end += delta;
+                    markerSpans[i].line += lineDelta;
+
+                    program.markers[i].instruction += instructionDelta;
+                    program.markers[i].byteIndex += byteDelta;
+                    markerSymbols[i]->value += byteDelta;
+                    markerSymbols[i]->lineFound += lineDelta;
+                }
+            }
+
+            for (std::size_t i = 0; i < definitionSpans.size(); i++) {
+                rebase(program.definitions[i].name);
+                rebase(program.definitions[i].value);
+
+                if (definitionSpans[i].begin >= stop) {
+                    definitionSpans[i].begin += delta;
+                    definitionSpans[i].end += delta;
+                    definitionSpans[i].line += lineDelta;
+                    definitionSymbols[i]->lineFound += lineDelta;
+                }
+            }
+
+            // the new instructions, now that the markers after them are where they end up
+            for (std::size_t i = 0; i < region.references.size(); i++) {
+                const SymbolReference &reference = region.references[i];
+                region.instructions[reference.instruction].operands[reference.operand] = regionSymbols[i]->value;
+            }
+
+            std::vector<unsigned char> encoded;
+
+            for (auto &instr: region.instructions)
+                encodeInstruction(instr, encoded);
+
+            std::vector<std::size_t> offsets;
+
+            for (auto &token: tokens) {
+                if (token.type == TokenType::OPCODE)
+                    offsets.push_back(token.valString.data - newBase);
+            }
+
+            for (std::size_t i = last; i < instructions.size(); i++) {
+                instructions[i].byteIndex += byteDelta;
+                instructions[i].lineFound += lineDelta;
+                instructionOffsets[i] += delta;
+            }
+
+            instructions.erase(instructions.begin() + first, instructions.begin() + last);
+            instructions.insert(instructions.begin() + first, region.instructions.begin(), region.instructions.end());
+
+            instructionOffsets.erase(instructionOffsets.begin() + first, instructionOffsets.begin() + last);
+            instructionOffsets.insert(instructionOffsets.begin() + first, offsets.begin(), offsets.end());
+
+            bytecode.erase(bytecode.begin() + oldBegin, bytecode.begin() + oldEnd);
+            bytecode.insert(bytecode.begin() + oldBegin, encoded.begin(), encoded.end());
+
+            // the references are in instruction order
+            auto instructionBefore = [](const SymbolReference &reference, std::size_t instruction) {
+                return reference.instruction < instruction;
+            };
+
+            std::size_t firstReference = std::lower_bound(references.begin(), references.end(), first,
+                                                          instructionBefore) - references.begin();
+            std::size_t lastReference = std::lower_bound(references.begin(), references.end(), last,
+                                                         instructionBefore) - references.begin();
+
+            for (std::size_t i = lastReference; i < references.size(); i++) {
+                references[i].instruction += instructionDelta;
+                references[i].lineFound += lineDelta;
+            }
+
+            for (auto &reference: region.references)
+                reference.instruction += first;
+
+            references.erase(references.begin() + firstReference, references.begin() + lastReference);
+            references.insert(references.begin() + firstReference, region.references.begin(),
+                              region.references.end());
+
+            referenceSymbols.erase(referenceSymbols.begin() + firstReference,
+                                   referenceSymbols.begin() + lastReference);
+            referenceSymbols.insert(referenceSymbols.begin() + firstReference, regionSymbols.begin(),
+                                    regionSymbols.end());
+
+            // references outside the edit to markers that moved
+            auto retarget = [&](std::size_t i) {
+                rebase(references[i].name);
+
+                IRInstruction &instr = instructions[references[i].instruction];
+                int value = referenceSymbols[i]->value;
+
+                if (instr.operands[references[i].operand] != value) {
+                    std::size_t at = instr.byteIndex + operandOffset(instr, references[i].operand);
+
+                    instr.operands[references[i].operand] = value;
+                    patchNumeric(bytecode, at, value);
+                    markDirty(at, at + 4);
+                }
+            };
+
+            for (std::size_t i = 0; i < firstReference; i++)
+                retarget(i);
+
+            for (std::size_t i = firstReference + region.references.size(); i < references.size(); i++)
+                retarget(i);
+
+            markDirty(oldBegin, byteDelta == 0 ? byteIndex : bytecode.size());
+            resized = resized || byteDelta != 0;
+
+            tokenCount = tokenCount - oldTokens + tokens.size();
+            source.swap(next);
+
+            return true;
+        }
+
+    public:
+        // assembles source, patching the previous build if it can. Returns true if it did, otherwise it assembled
+        // from scratch and throws like assemble does
+        bool update(std::string &next, PhaseTimer &timer, const std::atomic<bool> *cancelled = nullptr) {
+            if (patch(next)) {
+                timer.lap("patch", source.size());
+                return true;
+            }
+
+            source.swap(next);
+            build(timer, cancelled);
+
+            return false;
+        }
+
+        // writes the output, only the changed bytes if fileName still holds the previous build
+        void write(const std::string &fileName) {
+            std::size_t codeOffset = program.data.size() + 4;
+
+#ifdef CCA_HAS_MMAP
+            if (!rewrite && fileName == writtenName) {
+                int fd = ::open(fileName.c_str(), O_WRONLY);
+                struct stat info;
+                bool written = false;
+
+                // a second link would be the build cache's copy, it is rewritten below instead
+                if (fd >= 0 && fstat(fd, &info) == 0 && static_cast<std::size_t>(info.st_size) == writtenSize &&
+                    info.st_nlink == 1) {
+                    std::size_t length = dirtyEnd - dirtyBegin;
+
+                    written = length == 0 ||
+                              pwrite(fd, bytecode.data() + dirtyBegin, length, codeOffset + dirtyBegin) ==
+                              static_cast<ssize_t>(length);
+
+                    if (written && resized)
+                        written = ftruncate(fd, codeOffset + bytecode.size()) == 0;
+                }
+
+                if (fd >= 0)
+                    ::close(fd);
+
+                if (written) {
+                    writtenSize = codeOffset + bytecode.size();
+                    resized = false;
+                    dirtyBegin = dirtyEnd = 0;
+                    return;
+                }
+            }
+#endif
+
+            writeBytecode(fileName, program.data, bytecode);
+
+            writtenName = fileName;
+            writtenSize = codeOffset + bytecode.size();
+            rewrite = false;
+            resized = false;
+            dirtyBegin = dirtyEnd = 0;
+        }
+
+        void count(AssemblyCounts &counts) const {
+            counts.sourceBytes = source.size();
+            counts.tokens = tokenCount;
+            counts.instructions = program.instructions.size();
+            counts.symbols = program.symbols.size();
+            counts.dataBytes = program.data.size();
+            counts.codeBytes = bytecode.size();
+        }
+    };
+
+    AssemblyOutput assembleSource(const char *source, std::size_t size, const AssemblyOptions &options) {
+        AssemblyOutput output;
+
+        // the errors land in the output instead of the console, nothing else of the pipeline prints
+        DiagnosticCapture capture(output.diagnostics);
+
+        try {
+            StringRef code(source, size);
+            std::vector<unsigned char> data;
+            std::vector<unsigned char> bytecode;
+
+            if (options.onePass) {
+                OnePassAssembler onePass;
+                onePass.run(code);
+
+                data.swap(onePass.data);
+                bytecode.swap(onePass.bytecode);
+            } else {
+                std::vector<Token> tokens = lexer(code);
+                Program program;
+
+                parseDefinitions(tokens, program);
+                postTokenizer(tokens, program);
+                layoutInstructions(program);
+                resolveSymbols(program);
+                generateBytecode(program, bytecode);
+
+                data.swap(program.data);
+            }
+
+            appendImage(data, bytecode, output.bytecode);
+            output.succeeded = true;
+        } catch (const AssemblyError &) {
+            // reported already
+        } catch (const std::exception &e) {
+            Diagnostic diagnostic;
+            diagnostic.message = e.what();
+            output.diagnostics.push_back(diagnostic);
+        }
+
+        return output;
+    }
+
+    AssemblyOutput assembleSource(const std::string &source, const AssemblyOptions &options) {
+        return assembleSource(source.data(), source.size(), options);
+    }
+
+#ifndef CCA_LIBRARY
+    // -o, or the input with its extension replaced by .ccb
+    std::string outputFileName(const std::string &fileName, const cxxopts::ParseResult &result) {
+        if (result.count("output"))
+            return result["output"].as<std::string>();
+
+        // standard input goes to standard output, like any filter
+        if (fileName == "-")
+            return "-";
+
+        // the directories may have dots as well
+        std::size_t name = fileName.find_last_of("/\\");
+        name = name == std::string::npos ? 0 : name + 1;
+
+        return fileName.substr(0, fileName.find('.', name)) + ".ccb";
+    }
+
+    // the success message and whatever --trace, --mem-stats and --time-phases ask for
+    void reportAssembly(const std::string &fileName, const cxxopts::ParseResult &result, const std::string &mode,
+                        PhaseTimer::TimePoint begin, const PhaseTimer &timer, const AssemblyCounts &counts,
+                        Tracer *tracer) {
+        auto end = std::chrono::high_resolution_clock::now();
+
+        if (!result.count("silent")) {
+            console() << termcolor::green << "[INFO]" << termcolor::reset << " Successfully assembled "
+                      << termcolor::green << fileName << termcolor::reset << ", took " << termcolor::green
+                      << std::chrono::duration<double, std::milli>(end - begin).count() << termcolor::reset << "ms\n\n";
+        }
+
+        if (tracer) {
+            tracer->span("assemble", "assemble", begin, end, fileName);
+            tracePhases(*tracer, fileName, timer, counts);
+            tracer->flush();
+        }
+
+        if (result.count("mem-stats"))
+            printMemoryStats(fileName, timer);
+
+        if (result.count("time-phases")) {
+            if (result["time-phases"].as<std::string>() == "json")
+                printPhasesJson(fileName, mode, timer, counts);
+            else
+                printPhases(fileName, timer, counts);
+        }
+    }
+
+    // what besides the source decides the bytes of an output. -o only decides where they go, and the one-pass and
+    // multi-pass pipelines produce the same image so they share their entries. Spelling out the instruction set,
+    // the registers and the escapes keeps a build that changed them from restoring the images of another
+    std::string describeConfiguration() {
+        std::string configuration = std::string("CCAssembler ") + assemblerVersion + "\n";
+
+        for (auto &entry: instructionSet) {
+            configuration += entry.first;
+
+            for (auto &instr: entry.second) {
+                configuration += " " + std::to_string(instr.opcode);
+
+                for (TokenType arg: instr.args)
+                    configuration += "," + std::to_string(static_cast<int>(arg));
+            }
+
+            configuration += "\n";
+        }
+
+        // the flattened table also has the opcode ids the mnemonics are classified as
+        for (int opcode = 0; opcode < static_cast<int>(Opcode::COUNT); opcode++) {
+            for (int signature = 0; signature < SIGNATURE_COUNT; signature++) {
+                configuration += std::to_string(encodingTable.find(opcode, signature)) + ":" +
+                                 std::to_string(encodingTable.size(opcode, signature)) + " ";
+            }
+        }
+
+        configuration += "\n";
+
+        for (char name = 'a'; name <= 'z'; name++) {
+            int id = -1;
+
+            if (classifyWord(StringRef(&name, 1), id) == TokenType::REGISTER)
+                configuration += std::string(1, name) + "=" + std::to_string(id) + " ";
+        }
+
+        configuration += "\n";
+
+        // every printable character after a backslash, decoded the way def strings are
+        std::string escapes;
+
+        for (char c = ' '; c < 127; c++) {
+            escapes += '\\';
+            escapes += c;
+        }
+
+        std::vector<unsigned char> decoded;
+        decodeEscapes(StringRef(escapes), decoded);
+        configuration.append(decoded.begin(), decoded.end());
+
+        return configuration;
+    }
+
+    const std::string &cacheConfiguration() {
+        static const std::string configuration = describeConfiguration();
+        return configuration;
+    }
+
+    // tracer is optional, when given the phases of this assembly are added to it, setting cancelled stops the
+    // assembly at the next phase boundary with AssemblyCancelled. With a cache the output is restored from it when
+    // the same source was assembled before, except for --debug that wants to see the pipeline run
+    void assemble(std::string fileName, cxxopts::ParseResult result, Tracer *tracer = nullptr,
+                  const std::atomic<bool> *cancelled = nullptr, BuildCache *cache = nullptr) {
+        auto begin = std::chrono::high_resolution_clock::now();
+
+        uint8_t silent = result.count("silent");
+        std::string outputName = outputFileName(fileName, result);
+
+        if (!silent) {
+            console() << termcolor::green << "[INFO]" << termcolor::reset << " Parsing " << termcolor::green << fileName
+                      << termcolor::reset << "...\n\n";
+        }
+
+        PhaseTimer timer;
+        AssemblyCounts counts;
+
+        // the cache links its entries into place, that can't be done to standard output, and it needs the whole
+        // source for the key, which a streamed assembly never has
+        if (cache && (result.count("debug") || outputName == "-" || result.count("stream")))
+            cache = nullptr;
+
+        if (result.count("stream")) {
+            streamAssembly(fileName, outputName, silent, timer, counts, cancelled);
+
+            reportAssembly(fileName, result, "streaming", begin, timer, counts, tracer);
+            return;
+        }
+
+        // standard input is lexed as it arrives, unless the whole source is needed up front
+        bool streaming = fileName == "-" && !cache && !result.count("one-pass");
+
+        // the tokens point into the source, keep it alive until the bytecode is written
+        SourceFile source;
+        std::deque<std::string> chunks;
+
+        if (!streaming) {
+            readFile(fileName, source, !result.count("watch"));
+
+            counts.sourceBytes = source.contents().size();
+            timer.lap("read", counts.sourceBytes);
+            checkCancelled(cancelled);
+        }
+
+        BuildCache::Key cacheKey;
+
+        if (cache) {
+            cacheKey = cache->key(source.contents().data, source.contents().size(), cacheConfiguration());
+            bool restored = cache->restore(cacheKey, outputName);
+            timer.lap("cache", counts.sourceBytes);
+
+            if (restored) {
+                if (!silent) {
+                    console() << termcolor::green << "[INFO]" << termcolor::reset << " Restored " << termcolor::green
+                              << outputName << termcolor::reset << " from the cache\n\n";
+                }
+
+                reportAssembly(fileName, result, "cached", begin, timer, counts, tracer);
+                return;
+            }
+        }
+
+        std::vector<unsigned char> data;
+        std::vector<unsigned char> bytecode;
+
+        if (result.count("one-pass")) {
+            OnePassAssembler onePass;
+            onePass.run(source.contents());
+            onePass.count(counts);
+
+            timer.lap("assemble", counts.sourceBytes);
+            checkCancelled(cancelled);
+
+            // the errors come out of run, like they come before this line in a multi-pass assembly
+            if (!silent) {
+                console() << termcolor::green << "[INFO]" << termcolor::reset << " Generating " << termcolor::green
+                          << outputName << termcolor::reset << "...\n\n";
+            }
+
+            data.swap(onePass.data);
+            bytecode.swap(onePass.bytecode);
+        } else {
+            // tokenise, reading standard input on the way
+            std::vector<Token> tokens = streaming ? lexInput(chunks, counts.sourceBytes) : lexer(source.contents());
+
+            counts.tokens = tokens.size();
+            timer.lap(streaming ? "read+lex" : "lex", counts.sourceBytes);
+            checkCancelled(cancelled);
+
+            Program program;
+
+            // filter out the definitions
+            parseDefinitions(tokens, program);
+            timer.lap("definitions", counts.sourceBytes);
+            checkCancelled(cancelled);
+
+            // post tokenizer, lowers the tokens into instructions
+            postTokenizer(tokens, program);
+            timer.lap("lowering", counts.sourceBytes);
+            checkCancelled(cancelled);
+
+            // give every instruction and marker its address
+            layoutInstructions(program);
+            timer.lap("layout", counts.sourceBytes);
+            checkCancelled(cancelled);
+
+            // fill in the markers and definitions
+            resolveSymbols(program);
+            timer.lap("resolve", counts.sourceBytes);
+            checkCancelled(cancelled);
+
+            if (!silent) {
+                console() << termcolor::green << "[INFO]" << termcolor::reset << " Generating " << termcolor::green
+                          << outputName << termcolor::reset << "...\n\n";
+            }
+
+            if (result.count("debug")) {
+                // print the tokens for debug
+                console() << termcolor::blue << "[DEBUG]" << termcolor::reset << " Lexical analyzer result: \n";
+                printTokens(tokens);
+                console() << "\n";
+
+                // print the definitions for debug
+                console() << termcolor::blue << "[DEBUG]" << termcolor::reset << " Definitions found: \n";
+                printDefs(program.definitions);
+                console() << "\n";
+
+                // print the markers
+                console() << termcolor::blue << "[DEBUG]" << termcolor::reset << " Markers found: \n";
+                printMarkers(program.markers);
+                console() << "\n";
+
+                // print the lowered instructions
+                console() << termcolor::blue << "[DEBUG]" << termcolor::reset << " Instructions: \n";
+                printInstructions(program.instructions);
+                console() << "\n";
+
+                // keep the debug output out of the next phase
+                timer.lap("debug", 0);
+            }
+
+            generateBytecode(program, bytecode);
+
+            counts.instructions = program.instructions.size();
+            counts.symbols = program.symbols.size();
+            counts.codeBytes = bytecode.size();
+            timer.lap("encode", counts.codeBytes);
+            checkCancelled(cancelled);
+
+            data.swap(program.data);
+        }
+
+        counts.dataBytes = data.size();
+
+        writeBytecode(outputName, data, bytecode);
+        timer.lap("write", data.size() + 4 + bytecode.size());
+
+        if (cache) {
+            cache->store(cacheKey, outputName);
+            timer.lap("cache", data.size() + 4 + bytecode.size());
+        }
+
+        reportAssembly(fileName, result, result.count("one-pass") ? "one-pass" : "multi-pass", begin, timer, counts,
+                       tracer);
 
         return;
     }
 
+    // assemble for watch mode, patching what the previous build of the file left in state where it can
+    void reassemble(const std::string &fileName, const cxxopts::ParseResult &result, IncrementalAssembler &state,
+                    Tracer *tracer = nullptr, const std::atomic<bool> *cancelled = nullptr) {
+        auto begin = std::chrono::high_resolution_clock::now();
+
+        uint8_t silent = result.count("silent");
+        std::string outputName = outputFileName(fileName, result);
+
+        if (!silent) {
+            console() << termcolor::green << "[INFO]" << termcolor::reset << " Parsing " << termcolor::green << fileName
+                      << termcolor::reset << "...\n\n";
+        }
+
+        PhaseTimer timer;
+        AssemblyCounts counts;
+
+        // copied, the file may be rewritten while it is read
+        SourceFile source;
+        readFile(fileName, source, false);
+
+        std::string text = source.release();
+        timer.lap("read", text.size());
+        checkCancelled(cancelled);
+
+        bool patched = state.update(text, timer, cancelled);
+        checkCancelled(cancelled);
+
+        if (!silent) {
+            console() << termcolor::green << "[INFO]" << termcolor::reset << " Generating " << termcolor::green
+                      << outputName << termcolor::reset << "...\n\n";
+        }
+
+        state.count(counts);
+
+        state.write(outputName);
+        timer.lap("write", counts.dataBytes + 4 + counts.codeBytes);
+
+        reportAssembly(fileName, result, patched ? "incremental" : "multi-pass", begin, timer, counts, tracer);
+    }
+
+    // true if path matches pattern, * and ? stay inside a directory while ** crosses them, **/ may match nothing
+    bool matchesGlob(const char *pattern, const char *path) {
+        for (; *pattern; ++pattern, ++path) {
+            if (*pattern == '*') {
+                bool crossing = pattern[1] == '*';
+                pattern += crossing ? 2 : 1;
+
+                if (crossing && *pattern == '/' && matchesGlob(pattern + 1, path))
+                    return true;
+
+                for (;; ++path) {
+                    if (matchesGlob(pattern, path))
+                        return true;
+
+                    if (!*path || (!crossing && *path == '/'))
+                        return false;
+                }
+            }
+
+            if (!*path || (*pattern == '?' ? *path == '/' : *pattern != *path))
+                return false;
+        }
+
+        return !*path;
+    }
+
+    bool hasWildcards(const std::string &path) {
+        return path.find_first_of("*?") != std::string::npos;
+    }
+
+    // drops the ./ in front and the / behind, the watcher and the user spell the same file differently otherwise
+    std::string normalizePath(std::string path) {
+        while (path.size() > 2 && path.compare(0, 2, "./") == 0)
+            path.erase(0, 2);
+
+        while (path.size() > 1 && path.back() == '/')
+            path.pop_back();
+
+        return path;
+    }
+
+    bool isDirectory(const std::string &path) {
+#ifdef CCA_HAS_DIRENT
+        struct stat info;
+        return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+#else
+        return false;
+#endif
+    }
+
+    bool isRegularFile(const std::string &path) {
+#ifdef CCA_HAS_DIRENT
+        struct stat info;
+        return stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode);
+#else
+        return std::ifstream(path).good();
+#endif
+    }
+
+    // seconds since the epoch, 0 if it can't be told
+    time_t modificationTime(const std::string &path) {
+#ifdef CCA_HAS_DIRENT
+        struct stat info;
+        return stat(path.c_str(), &info) == 0 ? info.st_mtime : 0;
+#else
+        return 0;
+#endif
+    }
+
+    // the regular files in directory, and below it if recursive
+    void listFiles(const std::string &directory, bool recursive, std::vector<std::string> &files) {
+#ifdef CCA_HAS_DIRENT
+        DIR *dir = opendir(directory.c_str());
+
+        if (!dir)
+            return;
+
+        std::vector<std::string> directories;
+
+        while (dirent *entry = readdir(dir)) {
+            std::string name = entry->d_name;
+
+            if (name == "." || name == "..")
+                continue;
+
+            std::string path = directory + "/" + name;
+            struct stat info;
+
+            // lstat, a link to a parent directory would never end
+            if (lstat(path.c_str(), &info) != 0)
+                continue;
+
+            if (S_ISDIR(info.st_mode))
+                directories.push_back(path);
+            else if (S_ISREG(info.st_mode))
+                files.push_back(normalizePath(path));
+        }
+
+        closedir(dir);
+
+        if (recursive) {
+            for (const std::string &path: directories)
+                listFiles(path, true, files);
+        }
+#endif
+    }
+
+    // an input of watch mode, a file, a directory that stands for the .cca files below it, or a glob
+    struct WatchTarget {
+        std::string directory; // what the file watcher watches
+        std::string pattern; // the files of the target match it
+        bool recursive = false;
+        bool single = false; // a file named as it is
+    };
+
+    WatchTarget parseWatchTarget(const std::string &input) {
+        std::string path = normalizePath(input);
+        WatchTarget target;
+
+        if (hasWildcards(path)) {
+#ifndef CCA_HAS_DIRENT
+            console() << termcolor::red << "[ERROR]" << termcolor::reset << " Globs can't be watched on this platform\n";
+            throw AssemblyError();
+#endif
+            // the deepest directory in front of the first wildcard
+            std::size_t wildcard = path.find_first_of("*?");
+            std::size_t slash = path.rfind('/', wildcard);
+
+            target.directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+            target.pattern = path;
+            target.recursive = path.find('/', wildcard) != std::string::npos || path.find("**") != std::string::npos;
+        } else if (isDirectory(path)) {
+            target.directory = path;
+            target.pattern = (path == "." ? "" : path == "/" ? "/" : path + "/") + "**.cca";
+            target.recursive = true;
+        } else if (isRegularFile(path)) {
+            std::size_t slash = path.rfind('/');
+
+            // the directory, an editor that saves by renaming replaces the file and would end a watch on it
+            target.directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+            target.pattern = path;
+            target.single = true;
+        } else {
+            console() << termcolor::red << "[ERROR]" << termcolor::reset << " Could not find " << termcolor::red
+                      << input << termcolor::reset << "\n\n";
+            throw AssemblyError();
+        }
+
+        return target;
+    }
+
+    // the files a target stands for right now
+    std::vector<std::string> listTargetFiles(const WatchTarget &target) {
+        if (target.single)
+            return {target.pattern};
+
+        std::vector<std::string> files;
+        listFiles(target.directory, target.recursive, files);
+
+        files.erase(std::remove_if(files.begin(), files.end(), [&](const std::string &file) {
+            return !matchesGlob(target.pattern.c_str(), file.c_str());
+        }), files.end());
+
+        return files;
+    }
+
+    // -j, or one thread per core
+    unsigned int workerCount(const cxxopts::ParseResult &result) {
+        if (result.count("jobs"))
+            return static_cast<unsigned int>(std::max(1, result["jobs"].as<int>()));
+
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // builds files on worker threads once their changes have been quiet for the debounce window, the most recently
+    // changed file first; a change during the build of a file cancels it and schedules a fresh one
+    class RebuildPool {
+    public:
+        typedef std::chrono::steady_clock::time_point TimePoint;
+
+        // returns false if the build was cancelled, changed is the oldest change it picks up
+        typedef std::function<bool(const std::string &, const std::atomic<bool> &, TimePoint changed)> Build;
+
+    private:
+        struct Job {
+            TimePoint firstChange; // the oldest change the output is missing
+            TimePoint lastChange;
+            uint64_t order = 0; // the highest is built first
+            bool pending = false;
+            bool running = false;
+            std::atomic<bool> cancelled;
+
+            Job() : cancelled(false) {}
+        };
+
+        Build build;
+        std::chrono::milliseconds debounce;
+
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::map<std::string, std::unique_ptr<Job>> jobs; // never erased, the workers hold on to them
+        uint64_t nextOrder = 0;
+        bool stopping = false;
+
+        std::vector<std::thread> workers;
+
+        void run() {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            while (!stopping) {
+                TimePoint now = std::chrono::steady_clock::now();
+                TimePoint wake = TimePoint::max();
+                std::map<std::string, std::unique_ptr<Job>>::iterator next = jobs.end();
+
+                for (auto job = jobs.begin(); job != jobs.end(); ++job) {
+                    if (!job->second->pending || job->second->running)
+                        continue;
+
+                    // every change inside the window pushes the build back
+                    TimePoint ready = job->second->lastChange + debounce;
+
+                    if (ready > now)
+                        wake = std::min(wake, ready);
+                    else if (next == jobs.end() || job->second->order > next->second->order)
+                        next = job;
+                }
+
+                if (next == jobs.end()) {
+                    if (wake == TimePoint::max())
+                        changed.wait(lock);
+                    else
+                        changed.wait_until(lock, wake);
+
+                    continue;
+                }
+
+                Job &job = *next->second;
+                TimePoint since = job.firstChange;
+
+                job.pending = false;
+                job.running = true;
+                job.cancelled = false;
+
+                lock.unlock();
+                bool finished = build(next->first, job.cancelled, since);
+                lock.lock();
+
+                job.running = false;
+
+                // the output still misses the changes of a cancelled build
+                if (!finished && job.pending)
+                    job.firstChange = std::min(job.firstChange, since);
+            }
+        }
+
+    public:
+        RebuildPool(Build _build, std::chrono::milliseconds _debounce, unsigned int threads)
+                : build(_build), debounce(_debounce) {
+            for (unsigned int i = 0; i < threads; i++)
+                workers.emplace_back(&RebuildPool::run, this);
+        }
+
+        ~RebuildPool() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+
+                for (auto &job: jobs)
+                    job.second->cancelled = true;
+            }
+
+            changed.notify_all();
+
+            for (std::thread &worker: workers)
+                worker.join();
+        }
+
+        // immediately skips the debounce window, for the first builds
+        void schedule(const std::string &fileName, bool immediately = false) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                std::unique_ptr<Job> &job = jobs[fileName];
+
+                if (!job)
+                    job.reset(new Job());
+
+                TimePoint now = std::chrono::steady_clock::now();
+
+                if (!job->pending)
+                    job->firstChange = now;
+
+                job->pending = true;
+                job->lastChange = now - (immediately ? debounce : std::chrono::milliseconds(0));
+                job->order = ++nextOrder;
+                job->cancelled = true;
+            }
+
+            changed.notify_all();
+        }
+
+        // drops the pending build of a file and cancels a running one, for files that are gone
+        void cancel(const std::string &fileName) {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto job = jobs.find(fileName);
+
+            if (job != jobs.end()) {
+                job->second->pending = false;
+                job->second->cancelled = true;
+            }
+        }
+    };
+
     class AssemblerListener : public FW::FileWatchListener {
     private:
-        std::string fileName;
+        std::vector<WatchTarget> targets;
 
         cxxopts::ParseResult result;
 
+        Tracer *tracer;
+
+        // what the last build of every file left for the next one to patch, the pool never builds a file on two
+        // workers at once
+        std::mutex statesLock;
+        std::map<std::string, std::unique_ptr<IncrementalAssembler>> states;
+
+        // last, its workers use the members above
+        RebuildPool pool;
+
+        IncrementalAssembler &stateOf(const std::string &fileName) {
+            std::lock_guard<std::mutex> lock(statesLock);
+            std::unique_ptr<IncrementalAssembler> &state = states[fileName];
+
+            if (!state)
+                state.reset(new IncrementalAssembler());
+
+            return *state;
+        }
+
+        bool rebuild(const std::string &fileName, const std::atomic<bool> &cancelled, RebuildPool::TimePoint changed) {
+            // the messages of a build stay together, other workers print theirs at the same time
+            ConsoleCapture capture;
+
+            auto begin = std::chrono::high_resolution_clock::now();
+            const char *outcome = "rebuild";
+
+            try {
+                // the one-pass and debug builds don't keep anything to patch
+                if (result.count("one-pass") || result.count("debug"))
+                    assemble(fileName, result, tracer, &cancelled);
+                else
+                    reassemble(fileName, result, stateOf(fileName), tracer, &cancelled);
+            } catch (const AssemblyError &) {
+                outcome = "failed rebuild";
+
+                console() << termcolor::green << "[INFO]" << termcolor::reset << " Build failed, watching "
+                          << termcolor::green << fileName << termcolor::reset << " for changes...\n\n";
+            } catch (const std::exception &e) {
+                // whatever else goes wrong, like running out of memory, shouldn't end the watch
+                outcome = "failed rebuild";
+
+                console() << termcolor::red << "[ERROR] " << termcolor::reset << "Unable to assemble " << fileName
+                          << " (" << e.what() << ")\n";
+                console() << termcolor::green << "[INFO]" << termcolor::reset << " Build failed, watching "
+                          << termcolor::green << fileName << termcolor::reset << " for changes...\n\n";
+            } catch (const AssemblyCancelled &) {
+                outcome = "cancelled rebuild";
+
+                if (!result.count("silent")) {
+                    console() << termcolor::green << "[INFO]" << termcolor::reset << " Cancelled the build of "
+                              << termcolor::green << fileName << termcolor::reset << ", it changed again\n\n";
+                }
+            }
+
+            auto end = std::chrono::high_resolution_clock::now();
+            auto latency = std::chrono::steady_clock::now() - changed;
+            bool succeeded = outcome == std::string("rebuild");
+
+            // from the change to its output, the debounce window and the wait for a worker included
+            if (succeeded && !result.count("silent")) {
+                console() << termcolor::green << "[INFO] " << termcolor::reset << fileName << " is up to date, "
+                          << termcolor::green << std::chrono::duration<double, std::milli>(latency).count()
+                          << termcolor::reset << "ms after it changed\n\n";
+            }
+
+            if (tracer) {
+                tracer->span(outcome, "watch", begin, end, fileName);
+
+                if (succeeded) {
+                    auto since = end - std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(latency);
+                    tracer->span("change to output", "watch", since, end, fileName);
+                }
+
+                tracer->flush();
+            }
+
+            return outcome != std::string("cancelled rebuild");
+        }
+
     public:
-        AssemblerListener(std::string _fileName, cxxopts::ParseResult _result) {
-            fileName = _fileName;
-            result = _result;
+        AssemblerListener(std::vector<WatchTarget> _targets, cxxopts::ParseResult _result, Tracer *_tracer,
+                          std::chrono::milliseconds debounce, unsigned int threads)
+                : targets(_targets), result(_result), tracer(_tracer),
+                  pool([this](const std::string &fileName, const std::atomic<bool> &cancelled,
+                              RebuildPool::TimePoint changed) { return rebuild(fileName, cancelled, changed); },
+                       debounce, threads) {}
+
+        bool watches(const std::string &fileName) const {
+            for (const WatchTarget &target: targets) {
+                if (matchesGlob(target.pattern.c_str(), fileName.c_str()))
+                    return true;
+            }
+
+            return false;
+        }
+
+        void schedule(const std::string &fileName, bool immediately = false) {
+            pool.schedule(fileName, immediately);
         }
 
         void handleFileAction(FW::WatchID watchid, const FW::String &dir, const FW::String &filename,
                               FW::Action action) {
+            std::string fileName = normalizePath(filename.empty() ? dir : dir + "/" + filename);
+
+            if (!watches(fileName))
+                return;
+
             switch (action) {
+                case FW::Actions::Add:
                 case FW::Actions::Modified:
-                    assemble(fileName, result);
+                    // a new directory can match a glob too
+                    if (isRegularFile(fileName))
+                        schedule(fileName);
+                    break;
+                case FW::Actions::Delete:
+                    pool.cancel(fileName);
+                    break;
             }
         }
     };
 
-    void watchAssembly(std::string fileName, cxxopts::ParseResult result) {
-        AssemblerListener listener(fileName, result);
+    // watches files, directories and globs, and rebuilds the .cca files in them when they change
+    void watchAssembly(const std::vector<std::string> &inputs, cxxopts::ParseResult result, Tracer *tracer = nullptr) {
+        std::vector<WatchTarget> targets;
+
+        for (const std::string &input: inputs)
+            targets.push_back(parseWatchTarget(input));
+
+        if (result.count("output") && (targets.size() > 1 || !targets[0].single)) {
+            console() << termcolor::red << "[ERROR]" << termcolor::reset
+                      << " -o takes a single file, every other file is written next to its source\n\n";
+            throw AssemblyError();
+        }
+
+        std::chrono::milliseconds debounce(std::max(0, result["debounce"].as<int>()));
+
+        AssemblerListener listener(targets, result, tracer, debounce, workerCount(result));
 
         FW::FileWatcher fileWatcher;
 
-        FW::WatchID watchid = fileWatcher.addWatch(fileName, &listener);
+        // a directory is watched once, recursively if any target needs it
+        std::map<std::string, bool> directories;
+
+        for (const WatchTarget &target: targets)
+            directories[target.directory] = directories[target.directory] || target.recursive;
+
+        for (auto &directory: directories)
+            fileWatcher.addWatch(directory.first, &listener, directory.second);
+
+        // build everything once, the most recently modified file first
+        std::vector<std::pair<time_t, std::string>> files;
+
+        for (const WatchTarget &target: targets) {
+            for (const std::string &file: listTargetFiles(target))
+                files.emplace_back(modificationTime(file), file);
+        }
+
+        std::sort(files.begin(), files.end());
+        files.erase(std::unique(files.begin(), files.end()), files.end());
+
+        if (files.empty() && !result.count("silent")) {
+            console() << termcolor::green << "[INFO]" << termcolor::reset
+                      << " Nothing to assemble yet, watching for new files...\n\n";
+        }
+
+        for (auto &file: files)
+            listener.schedule(file.second, true);
+
+        // sleeps in poll until inotify has an event, a busy loop would keep a core spinning
+        while (true) {
+            fileWatcher.update(-1);
+        }
+    }
+
+    // the inputs with every @file replaced by the files it lists, one per line, # starts a comment line
+    std::vector<std::string> expandInputs(const std::vector<std::string> &args) {
+        std::vector<std::string> inputs;
+
+        for (const std::string &arg: args) {
+            if (arg.size() < 2 || arg[0] != '@') {
+                inputs.push_back(arg);
+                continue;
+            }
+
+            std::ifstream list(arg.substr(1));
+
+            if (!list) {
+                console() << termcolor::red << "[ERROR]" << termcolor::reset << " Could not open the file list '"
+                          << arg.substr(1) << "'\n\n";
+                throw AssemblyError();
+            }
+
+            std::string line;
+
+            while (std::getline(list, line)) {
+                std::size_t begin = line.find_first_not_of(" \t\r");
+                std::size_t end = line.find_last_not_of(" \t\r");
+
+                if (begin != std::string::npos && line[begin] != '#')
+                    inputs.push_back(line.substr(begin, end - begin + 1));
+            }
+        }
+
+        return inputs;
+    }
+
+    // runs every task once on up to threads threads, each works through its own deque from the front and steals
+    // from the back of the others once it is empty; the caller's thread is one of them
+    void runWorkStealing(const std::vector<std::function<void()>> &tasks, unsigned int threads) {
+        struct Worker {
+            std::mutex lock;
+            std::deque<std::size_t> tasks;
+        };
+
+        threads = static_cast<unsigned int>(std::max<std::size_t>(1, std::min<std::size_t>(threads, tasks.size())));
+
+        std::vector<std::unique_ptr<Worker>> workers;
+
+        for (unsigned int i = 0; i < threads; i++)
+            workers.emplace_back(new Worker());
+
+        // dealt out in order, the first tasks start first
+        for (std::size_t i = 0; i < tasks.size(); i++)
+            workers[i % threads]->tasks.push_back(i);
+
+        // nothing is added once they run, a worker that finds every deque empty is done
+        auto work = [&](unsigned int self) {
+            while (true) {
+                std::size_t task = tasks.size();
+
+                for (unsigned int i = 0; i < threads && task == tasks.size(); i++) {
+                    Worker &victim = *workers[(self + i) % threads];
+                    std::lock_guard<std::mutex> guard(victim.lock);
+
+                    if (victim.tasks.empty())
+                        continue;
+
+                    if (i == 0) {
+                        task = victim.tasks.front();
+                        victim.tasks.pop_front();
+                    } else {
+                        task = victim.tasks.back();
+                        victim.tasks.pop_back();
+                    }
+                }
+
+                if (task == tasks.size())
+                    return;
+
+                tasks[task]();
+            }
+        };
+
+        std::vector<std::thread> helpers;
+
+        for (unsigned int i = 1; i < threads; i++)
+            helpers.emplace_back(work, i);
+
+        work(0);
+
+        for (std::thread &helper: helpers)
+            helper.join();
+    }
+
+    std::size_t fileSize(const std::string &fileName) {
+        std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+        return file ? static_cast<std::size_t>(std::max<std::streamoff>(0, file.tellg())) : 0;
+    }
+
+    // assembles every input with -j threads, the messages of a file come out in one piece, returns the number of
+    // files that failed
+    std::size_t assembleBatch(const std::vector<std::string> &inputs, cxxopts::ParseResult result,
+                              Tracer *tracer = nullptr, BuildCache *cache = nullptr) {
+        auto begin = std::chrono::high_resolution_clock::now();
+
+        if (result.count("output")) {
+            console() << termcolor::red << "[ERROR]" << termcolor::reset
+                      << " -o takes a single file, every other file is written next to its source\n\n";
+            throw AssemblyError();
+        }
+
+        // two inputs writing the same output would race for it
+        std::map<std::string, std::string> outputs;
+
+        for (const std::string &input: inputs) {
+            auto output = outputs.insert(std::make_pair(outputFileName(input, result), input));
+
+            if (!output.second && output.first->second != input) {
+                console() << termcolor::red << "[ERROR]" << termcolor::reset << " " << output.first->second
+                          << " and " << input << " would both be written to " << output.first->first << "\n\n";
+                throw AssemblyError();
+            }
+        }
+
+        // the largest first, one of them starting last would keep a single core busy at the end
+        std::vector<std::pair<std::size_t, std::string>> files;
+
+        for (auto &output: outputs)
+            files.emplace_back(fileSize(output.second), output.second);
+
+        std::stable_sort(files.begin(), files.end(), [](const std::pair<std::size_t, std::string> &a,
+                                                        const std::pair<std::size_t, std::string> &b) {
+            return a.first > b.first;
+        });
+
+        // char, the workers write next to each other
+        std::vector<char> failed(files.size(), 0);
+        std::vector<std::function<void()>> tasks;
+
+        for (std::size_t i = 0; i < files.size(); i++) {
+            tasks.push_back([&, i] {
+                const std::string &fileName = files[i].second;
+                ConsoleCapture capture;
+
+                try {
+                    assemble(fileName, result, tracer, nullptr, cache);
+                    return;
+                } catch (const AssemblyError &) {
+                } catch (const std::exception &e) {
+                    // running out of memory on one file shouldn't take the others down
+                    console() << termcolor::red << "[ERROR]" << termcolor::reset << " Unexpected failure (" << e.what()
+                              << ")\n";
+                }
+
+                failed[i] = 1;
+
+                // the errors above don't name the file
+                console() << termcolor::red << "[ERROR]" << termcolor::reset << " Failed to assemble "
+                          << termcolor::red << fileName << termcolor::reset << "\n\n";
+            });
+        }
+
+        runWorkStealing(tasks, workerCount(result));
+
+        std::size_t failures = std::count(failed.begin(), failed.end(), 1);
+        auto end = std::chrono::high_resolution_clock::now();
+
+        if (failures > 0) {
+            console() << termcolor::red << "[ERROR]" << termcolor::reset << " " << failures << " of " << files.size()
+                      << " files failed:";
+
+            for (std::size_t i = 0; i < files.size(); i++) {
+                if (failed[i])
+                    console() << " " << files[i].second;
+            }
+
+            console() << "\n\n";
+        } else if (!result.count("silent")) {
+            console() << termcolor::green << "[INFO]" << termcolor::reset << " Assembled " << termcolor::green
+                      << files.size() << termcolor::reset << (files.size() == 1 ? " file" : " files")
+                      << ", took " << termcolor::green
+                      << std::chrono::duration<double, std::milli>(end - begin).count() << termcolor::reset << "ms\n\n";
+        }
+
+        if (tracer) {
+            tracer->span("batch", "assemble", begin, end);
+            tracer->flush();
+        }
+
+        return failures;
+    }
+
+#ifdef CCA_HAS_UNIX_SOCKETS
+    // buffered reads from a --serve client, the header lines are short and their payloads follow right behind
+    enum class LineRead {
+        LINE,
+        CLOSED, // the connection ended before the line did
+        TOO_LONG // the line doesn't fit the buffer
+    };
+
+    class SocketReader {
+    private:
+        int fd;
+        std::vector<char> buffer;
+        std::size_t begin = 0;
+        std::size_t end = 0;
+
+        // false at the end of the connection
+        bool fill() {
+            if (begin == end)
+                begin = end = 0;
+
+            if (end == buffer.size()) {
+                std::copy(buffer.begin() + begin, buffer.begin() + end, buffer.begin());
+                end -= begin;
+                begin = 0;
+            }
+
+            while (true) {
+                ssize_t got = ::read(fd, buffer.data() + end, buffer.size() - end);
+
+                if (got > 0) {
+                    end += got;
+                    return true;
+                }
+
+                if (got < 0 && errno == EINTR)
+                    continue;
+
+                return false;
+            }
+        }
+
+    public:
+        explicit SocketReader(int _fd) : fd(_fd), buffer(1 << 16) {}
+
+        LineRead readLine(std::string &line) {
+            line.clear();
+
+            while (true) {
+                const char *data = buffer.data();
+                const char *newline = static_cast<const char *>(std::memchr(data + begin, '\n', end - begin));
+
+                if (newline) {
+                    line.append(data + begin, newline);
+                    begin = newline - data + 1;
+                    return LineRead::LINE;
+                }
+
+                if (end - begin == buffer.size())
+                    return LineRead::TOO_LONG;
+
+                if (!fill())
+                    return LineRead::CLOSED;
+            }
+        }
+
+        // the string grows with what arrives, a size the client only claims reserves nothing
+        bool readExact(std::string &out, std::size_t size) {
+            out.clear();
+
+            while (out.size() < size) {
+                if (begin == end && !fill())
+                    return false;
+
+                std::size_t take = std::min(size - out.size(), end - begin);
+                out.append(buffer.data() + begin, take);
+                begin += take;
+            }
+
+            return true;
+        }
+    };
+
+    bool writeAll(int fd, const char *data, std::size_t size) {
+        while (size > 0) {
+            ssize_t written = ::write(fd, data, size);
+
+            if (written < 0 && errno == EINTR)
+                continue;
+
+            if (written <= 0)
+                return false;
+
+            data += written;
+            size -= written;
+        }
+
+        return true;
+    }
+
+    // a request of a --serve client, see serveAssembly
+    struct ServeRequest {
+        std::string command;
+        bool onePass = false;
+
+        bool hasPath = false;
+        bool hasSource = false;
+        bool hasOutput = false;
+
+        std::string path;
+        std::string source;
+        std::string output;
+    };
+
+    // clients served at once, the ones beyond are turned away
+    const int maxServeClients = 64;
+
+    // returns what is wrong with the request, empty if nothing is; closed is set when the client hung up. No payload
+    // may be longer than maxPayload
+    std::string readServeRequest(SocketReader &reader, ServeRequest &request, bool &closed, std::size_t maxPayload) {
+        std::string header;
+        closed = false;
+
+        LineRead read = reader.readLine(header);
+
+        if (read == LineRead::TOO_LONG)
+            return "header line too long";
+
+        if (read == LineRead::CLOSED) {
+            closed = true;
+            return "";
+        }
+
+        std::stringstream words(header);
+        std::string word;
+
+        words >> request.command;
+
+        if (request.command != "assemble" && request.command != "check")
+            return "unknown command '" + request.command + "'";
+
+        // the payloads follow the header in the order of their fields
+        while (words >> word) {
+            if (word == "one-pass") {
+                request.onePass = true;
+                continue;
+            }
+
+            std::size_t colon = word.find(':');
+            std::string field = word.substr(0, colon);
+            std::string *value = field == "path" ? &request.path : field == "source" ? &request.source :
+                                 field == "output" ? &request.output : nullptr;
+
+            if (!value || colon == std::string::npos)
+                return "unknown field '" + word + "'";
+
+            std::size_t size = 0;
+
+            try {
+                size = std::stoull(word.substr(colon + 1));
+            } catch (const std::exception &) {
+                return "bad length in '" + word + "'";
+            }
+
+            if (size > maxPayload)
+                return "payload of '" + word + "' too large, the limit is " + std::to_string(maxPayload) + " bytes";
+
+            if (!reader.readExact(*value, size)) {
+                closed = true;
+                return "";
+            }
+
+            (field == "path" ? request.hasPath : field == "source" ? request.hasSource : request.hasOutput) = true;
+        }
+
+        if (request.hasPath == request.hasSource)
+            return "expected either a path or a source";
+
+        return "";
+    }
+
+    // the response to a request: the header, the image unless it was checked or written, then one diagnostic per
+    // line
+    std::string answerServeRequest(const ServeRequest &request) {
+        AssemblyOptions options;
+        options.onePass = request.onePass;
+
+        AssemblyOutput output;
+
+        if (request.hasPath) {
+            std::vector<Diagnostic> readErrors;
+            SourceFile file;
+
+            try {
+                DiagnosticCapture capture(readErrors);
+
+                // copied, a mapped file truncated by a writer would take the whole server down
+                readFile(request.path, file, false);
+                output = assembleSource(file.contents().data, file.contents().size(), options);
+            } catch (const AssemblyError &) {
+                output.diagnostics = readErrors;
+            }
+        } else {
+            output = assembleSource(request.source, options);
+        }
+
+        if (output.succeeded && request.hasOutput && request.command == "assemble") {
+            const OutputPiece image = {output.bytecode.data(), output.bytecode.size()};
+
+            if (!writeOutputFile(request.output, &image, 1)) {
+                Diagnostic diagnostic;
+                diagnostic.message = "Could not write '" + request.output + "'";
+                output.diagnostics.push_back(diagnostic);
+                output.succeeded = false;
+            }
+        }
+
+        if (request.command == "check" || request.hasOutput)
+            output.bytecode.clear();
+
+        std::string response = std::string(output.succeeded ? "ok" : "failed") + " bytecode:" +
+                               std::to_string(output.bytecode.size()) + " diagnostics:" +
+                               std::to_string(output.diagnostics.size()) + "\n";
+
+        response.append(output.bytecode.begin(), output.bytecode.end());
+
+        for (const Diagnostic &diagnostic: output.diagnostics) {
+            std::string message = diagnostic.message;
+            std::replace(message.begin(), message.end(), '\n', ' ');
+            response += std::to_string(diagnostic.line) + " " + message + "\n";
+        }
+
+        return response;
+    }
+
+    // answers the requests of one client until it hangs up, then gives its place back to the others
+    void serveConnection(int client, bool onePass, std::size_t maxPayload, std::atomic<int> *clients,
+                         Tracer *tracer) {
+        SocketReader reader(client);
+
+        while (true) {
+            ServeRequest request;
+            request.onePass = onePass;
+            bool closed;
+
+            std::string problem = readServeRequest(reader, request, closed, maxPayload);
+
+            if (closed)
+                break;
+
+            // the rest of the stream can't be framed any more
+            if (!problem.empty()) {
+                std::string response = "bad-request " + problem + "\n";
+                writeAll(client, response.data(), response.size());
+                break;
+            }
+
+            auto begin = std::chrono::high_resolution_clock::now();
+            std::string response = answerServeRequest(request);
+
+            if (tracer) {
+                tracer->span(request.command, "serve", begin, std::chrono::high_resolution_clock::now(),
+                             request.hasPath ? request.path : "");
+            }
+
+            if (!writeAll(client, response.data(), response.size()))
+                break;
+        }
+
+        ::close(client);
+        --*clients;
+    }
+
+    // --serve: keeps one assembler process warm behind a Unix socket. A client sends requests like
+    //     assemble one-pass source:<n> output:<m>\n<n bytes of source><m bytes of output name>
+    // where the command is assemble or check, one of path:<n> or source:<n> names the input and output:<n> makes
+    // the server write the image instead of returning it. The answer is
+    //     ok|failed bytecode:<n> diagnostics:<m>\n<n bytes of image><m lines of "<line> <message>">
+    // or "bad-request <why>" before the server hangs up. Every connection is served on its own thread, up to
+    // maxServeClients at once, and no payload may be larger than --serve-max-payload.
+    //
+    // A request builds what a plain command line build does, one-pass being the only option it takes. There is no
+    // -d or -s, they only change what is printed, and the server prints nothing for a request: the images are the
+    // same either way and the errors go back as the diagnostics.
+    //
+    // A client reads and writes files with the rights of the server, through path: and output:, so the socket is
+    // only open to the user running it. Loosening its mode trusts everyone who can connect with those files.
+    void serveAssembly(const std::string &socketPath, cxxopts::ParseResult result, Tracer *tracer = nullptr) {
+        sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+
+        if (socketPath.size() >= sizeof(address.sun_path)) {
+            console() << termcolor::red << "[ERROR]" << termcolor::reset << " The socket path '" << socketPath
+                      << "' is too long\n\n";
+            throw AssemblyError();
+        }
+
+        std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size());
+
+        // a client hanging up mid answer shouldn't end the server
+        signal(SIGPIPE, SIG_IGN);
+
+        // a live server keeps its socket, a dead one leaves it behind to be replaced
+        struct stat info;
+
+        if (lstat(socketPath.c_str(), &info) == 0) {
+            int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+            bool live = connect(probe, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0;
+            ::close(probe);
+
+            if (live || !S_ISSOCK(info.st_mode)) {
+                console() << termcolor::red << "[ERROR]" << termcolor::reset << " '" << socketPath << "' is "
+                          << (live ? "served already" : "in the way, it is no socket") << "\n\n";
+                throw AssemblyError();
+            }
+
+            unlink(socketPath.c_str());
+        }
+
+        uint64_t maxPayload = 0;
+
+        if (!parseByteSize(result["serve-max-payload"].as<std::string>(), maxPayload)) {
+            console() << termcolor::red << "[ERROR]" << termcolor::reset << " Invalid payload limit '"
+                      << result["serve-max-payload"].as<std::string>() << "'\n\n";
+            throw AssemblyError();
+        }
+
+        int server = socket(AF_UNIX, SOCK_STREAM, 0);
+
+        // owner only from the start, there is no moment a chmod after bind could be raced
+        mode_t mask = umask(0177);
+        bool bound = server >= 0 && bind(server, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0;
+        umask(mask);
 
-        assemble(fileName, result);
+        if (!bound || chmod(socketPath.c_str(), 0600) != 0 || listen(server, SOMAXCONN) != 0) {
+            console() << termcolor::red << "[ERROR]" << termcolor::reset << " Could not serve on '" << socketPath
+                      << "': " << std::strerror(errno) << "\n\n";
+            throw AssemblyError();
+        }
+
+        if (!result.count("silent")) {
+            console() << termcolor::green << "[INFO]" << termcolor::reset << " Serving on " << termcolor::green
+                      << socketPath << termcolor::reset << "...\n\n";
+            console().flush();
+        }
+
+        bool onePass = result.count("one-pass");
+
+        // lives as long as the process, the detached threads may outlast this function
+        static std::atomic<int> clients(0);
 
         while (true) {
-            fileWatcher.update();
+            int client = accept(server, nullptr, nullptr);
+
+            if (client < 0) {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+
+                // out of descriptors, the clients that hang up free some
+                if (errno == EMFILE || errno == ENFILE) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                    continue;
+                }
+
+                console() << termcolor::red << "[ERROR]" << termcolor::reset << " Could not accept a client: "
+                          << std::strerror(errno) << "\n\n";
+                throw AssemblyError();
+            }
+
+            if (clients >= maxServeClients) {
+                const std::string response = "bad-request too many clients\n";
+                writeAll(client, response.data(), response.size());
+                ::close(client);
+                continue;
+            }
+
+            ++clients;
+            std::thread(serveConnection, client, onePass, static_cast<std::size_t>(maxPayload), &clients, tracer)
+                    .detach();
         }
     }
-}
\ No newline at end of file
+#endif
+#endif
+}
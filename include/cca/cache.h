@@ -0,0 +1,370 @@
+#pragma once
+
+// stdlib headers
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// platform headers
+#if defined(__unix__) || defined(__APPLE__)
+#define CCA_HAS_BUILD_CACHE 1
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+// other libraries
+#include <termcolor/termcolor.hpp>
+
+// assembler headers
+#include <cca/console.h>
+
+namespace CCA {
+    // xxHash64, fast and good enough to tell sources apart, it is no defence against crafted collisions
+    uint64_t hash64(const void *input, std::size_t size, uint64_t seed) {
+        const uint64_t P1 = 0x9E3779B185EBCA87ull;
+        const uint64_t P2 = 0xC2B2AE3D27D4EB4Full;
+        const uint64_t P3 = 0x165667B19E3779F9ull;
+        const uint64_t P4 = 0x85EBCA77C2B2AE63ull;
+        const uint64_t P5 = 0x27D4EB2F165667C5ull;
+
+        auto rotate = [](uint64_t x, int bits) { return (x << bits) | (x >> (64 - bits)); };
+        auto read64 = [](const unsigned char *p) { uint64_t v; std::memcpy(&v, p, 8); return v; };
+        auto read32 = [](const unsigned char *p) { uint32_t v; std::memcpy(&v, p, 4); return v; };
+        auto step = [&](uint64_t acc, uint64_t lane) { return rotate(acc + lane * P2, 31) * P1; };
+        auto merge = [&](uint64_t acc, uint64_t lane) { return (acc ^ step(0, lane)) * P1 + P4; };
+
+        const unsigned char *p = static_cast<const unsigned char *>(input);
+        const unsigned char *end = p + size;
+        uint64_t h;
+
+        if (size >= 32) {
+            uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+
+            for (; p + 32 <= end; p += 32) {
+                v1 = step(v1, read64(p));
+                v2 = step(v2, read64(p + 8));
+                v3 = step(v3, read64(p + 16));
+                v4 = step(v4, read64(p + 24));
+            }
+
+            h = rotate(v1, 1) + rotate(v2, 7) + rotate(v3, 12) + rotate(v4, 18);
+            h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+        } else {
+            h = seed + P5;
+        }
+
+        h += size;
+
+        for (; p + 8 <= end; p += 8)
+            h = rotate(h ^ step(0, read64(p)), 27) * P1 + P4;
+
+        if (p + 4 <= end) {
+            h = rotate(h ^ (read32(p) * P1), 23) * P2 + P3;
+            p += 4;
+        }
+
+        for (; p < end; ++p)
+            h = rotate(h ^ (*p * P5), 11) * P1;
+
+        h ^= h >> 33;
+        h *= P2;
+        h ^= h >> 29;
+        h *= P3;
+        h ^= h >> 32;
+
+        return h;
+    }
+
+    // finished .ccb images by the hash of what they were assembled from. An entry is named after its key in a
+    // subdirectory named after the first two digits, its modification time is its last use, and the oldest entries
+    // are evicted once the cache outgrows its limit. Several processes can share a directory, the bookkeeping in
+    // the stats file is done under a lock
+    class BuildCache {
+    public:
+        struct Key {
+            uint64_t high = 0;
+            uint64_t low = 0;
+
+            std::string hex() const {
+                char digits[33];
+                std::snprintf(digits, sizeof(digits), "%016llx%016llx", static_cast<unsigned long long>(high),
+                              static_cast<unsigned long long>(low));
+                return digits;
+            }
+        };
+
+        // kept in the stats file, across runs
+        struct Totals {
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+            uint64_t evictions = 0;
+            uint64_t size = 0;
+        };
+
+    private:
+        std::string directory;
+        uint64_t limit = 0;
+
+        // of this run
+        std::atomic<uint64_t> hits;
+        std::atomic<uint64_t> misses;
+
+        std::atomic<uint64_t> temporaries;
+
+        std::string entryName(const Key &key) const {
+            std::string hex = key.hex();
+            return directory + "/" + hex.substr(0, 2) + "/" + hex + ".ccb";
+        }
+
+#ifdef CCA_HAS_BUILD_CACHE
+        static bool makeDirectory(const std::string &path) {
+            return mkdir(path.c_str(), 0777) == 0 || errno == EEXIST;
+        }
+
+        static bool readTotals(const std::string &fileName, Totals &totals) {
+            std::ifstream file(fileName);
+            std::string name;
+            uint64_t value;
+
+            while (file >> name >> value) {
+                if (name == "hits")
+                    totals.hits = value;
+                else if (name == "misses")
+                    totals.misses = value;
+                else if (name == "evictions")
+                    totals.evictions = value;
+                else if (name == "size")
+                    totals.size = value;
+            }
+
+            return true;
+        }
+
+        static void writeTotals(const std::string &fileName, const Totals &totals) {
+            std::ofstream file(fileName, std::ios::trunc);
+            file << "hits " << totals.hits << "\nmisses " << totals.misses << "\nevictions " << totals.evictions
+                 << "\nsize " << totals.size << "\n";
+        }
+
+        // runs update on the totals with the directory locked against other processes
+        template<typename Update>
+        void withTotals(Update update) {
+            int lock = ::open((directory + "/lock").c_str(), O_RDWR | O_CREAT, 0666);
+
+            if (lock >= 0)
+                flock(lock, LOCK_EX);
+
+            Totals totals;
+            readTotals(directory + "/stats", totals);
+            update(totals);
+            writeTotals(directory + "/stats", totals);
+
+            if (lock >= 0) {
+                flock(lock, LOCK_UN);
+                ::close(lock);
+            }
+        }
+
+        // drops the least recently used entries until the cache is down to three quarters of its limit, the
+        // size is recounted on the way so it can't drift
+        void evict(Totals &totals) {
+            struct Entry {
+                time_t used;
+                uint64_t size;
+                std::string name;
+
+                bool operator<(const Entry &other) const {
+                    return used < other.used;
+                }
+            };
+
+            std::vector<Entry> entries;
+            uint64_t size = 0;
+
+            DIR *root = opendir(directory.c_str());
+
+            if (!root)
+                return;
+
+            while (dirent *bucket = readdir(root)) {
+                std::string bucketName = bucket->d_name;
+
+                if (bucketName.size() != 2 || bucketName == "..")
+                    continue;
+
+                DIR *files = opendir((directory + "/" + bucketName).c_str());
+
+                if (!files)
+                    continue;
+
+                while (dirent *file = readdir(files)) {
+                    std::string name = directory + "/" + bucketName + "/" + file->d_name;
+                    struct stat info;
+
+                    if (file->d_name[0] == '.' || stat(name.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+                        continue;
+
+                    entries.push_back(Entry{info.st_mtime, static_cast<uint64_t>(info.st_size), name});
+                    size += info.st_size;
+                }
+
+                closedir(files);
+            }
+
+            closedir(root);
+
+            std::sort(entries.begin(), entries.end());
+
+            for (const Entry &entry: entries) {
+                if (size <= limit / 4 * 3)
+                    break;
+
+                if (unlink(entry.name.c_str()) == 0) {
+                    size -= entry.size;
+                    ++totals.evictions;
+                }
+            }
+
+            totals.size = size;
+        }
+#endif
+
+    public:
+        BuildCache() : hits(0), misses(0), temporaries(0) {}
+
+        // creates the directory if needed, false if it can't be used
+        bool open(const std::string &_directory, uint64_t _limit) {
+#ifdef CCA_HAS_BUILD_CACHE
+            directory = _directory;
+            limit = _limit;
+
+            while (directory.size() > 1 && directory.back() == '/')
+                directory.pop_back();
+
+            // the parents as well
+            for (std::size_t slash = directory.find('/', 1); slash != std::string::npos;
+                 slash = directory.find('/', slash + 1))
+                makeDirectory(directory.substr(0, slash));
+
+            return makeDirectory(directory) && access(directory.c_str(), W_OK) == 0;
+#else
+            return false;
+#endif
+        }
+
+        // the source is hashed once, the other half tells apart the configurations, what goes into the output
+        // besides the source, and the source sizes
+        Key key(const char *source, std::size_t size, const std::string &configuration) const {
+            Key key;
+            key.high = hash64(source, size, 0);
+            key.low = hash64(configuration.data(), configuration.size(), size);
+            return key;
+        }
+
+        // puts the image cached for key at fileName, false on a miss
+        bool restore(const Key &key, const std::string &fileName) {
+#ifdef CCA_HAS_BUILD_CACHE
+            std::string entry = entryName(key);
+            bool restored = false;
+
+            if (access(entry.c_str(), R_OK) == 0) {
+                // a hard link if they are on one file system, writeBytecode replaces links instead of writing
+                // through them so the cached copy stays as it is
+                unlink(fileName.c_str());
+                restored = link(entry.c_str(), fileName.c_str()) == 0;
+
+                if (!restored) {
+                    std::ifstream in(entry, std::ios::binary);
+                    std::ofstream out(fileName, std::ios::binary | std::ios::trunc);
+                    out << in.rdbuf();
+                    restored = in && out;
+                }
+
+                // the modification time of an entry is its last use
+                if (restored)
+                    utimes(entry.c_str(), nullptr);
+            }
+
+            ++(restored ? hits : misses);
+            withTotals([&](Totals &totals) { ++(restored ? totals.hits : totals.misses); });
+
+            return restored;
+#else
+            return false;
+#endif
+        }
+
+        // keeps a copy of the output just written to fileName for key, linked or copied aside and renamed into
+        // place so no reader ever sees half of it
+        void store(const Key &key, const std::string &fileName) {
+#ifdef CCA_HAS_BUILD_CACHE
+            std::string entry = entryName(key);
+            std::ostringstream temporary;
+            temporary << directory << "/.tmp-" << getpid() << "-" << std::this_thread::get_id() << "-"
+                      << temporaries++;
+
+            if (link(fileName.c_str(), temporary.str().c_str()) != 0) {
+                std::ifstream in(fileName, std::ios::binary);
+                std::ofstream out(temporary.str(), std::ios::binary | std::ios::trunc);
+                out << in.rdbuf();
+
+                if (!in || !out) {
+                    unlink(temporary.str().c_str());
+                    return;
+                }
+            }
+
+            struct stat info;
+            bool replaced = access(entry.c_str(), F_OK) == 0;
+
+            makeDirectory(entry.substr(0, entry.rfind('/')));
+
+            if (stat(temporary.str().c_str(), &info) != 0 || rename(temporary.str().c_str(), entry.c_str()) != 0) {
+                unlink(temporary.str().c_str());
+                return;
+            }
+
+            withTotals([&](Totals &totals) {
+                // an entry that was there already had the same contents
+                if (!replaced)
+                    totals.size += info.st_size;
+
+                if (totals.size > limit)
+                    evict(totals);
+            });
+#endif
+        }
+
+        // --cache-stats
+        void printStats() {
+            Totals totals;
+
+#ifdef CCA_HAS_BUILD_CACHE
+            withTotals([&](Totals &current) { totals = current; });
+#endif
+
+            uint64_t runHits = hits, runMisses = misses;
+            uint64_t lookups = totals.hits + totals.misses;
+
+            console() << termcolor::blue << "[CACHE]" << termcolor::reset << " " << termcolor::green << directory
+                      << termcolor::reset << "\n";
+            console() << "  this run     | " << runHits << " hits, " << runMisses << " misses\n";
+            console() << "  all runs     | " << totals.hits << " hits, " << totals.misses << " misses, "
+                      << (lookups ? totals.hits * 100 / lookups : 0) << "% hit rate, " << totals.evictions
+                      << " evicted\n";
+            console() << "  size         | " << totals.size << " of " << limit << " bytes\n\n";
+        }
+    };
+}
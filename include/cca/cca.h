@@ -0,0 +1,36 @@
+#pragma once
+
+// the interface of libcca, the assembler without the command line: source bytes in, bytecode bytes out. Include
+// this and link cca, assembler.h is the implementation and can't be included next to the library
+
+// stdlib headers
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace CCA {
+    // an error found in the source, line is 0 for errors that belong to no line
+    struct Diagnostic {
+        int line = 0;
+        std::string message;
+    };
+
+    struct AssemblyOptions {
+        bool onePass = false; // as --one-pass
+    };
+
+    struct AssemblyOutput {
+        bool succeeded = false;
+
+        // the .ccb image: the data section, the Section Seperation Sequence and the code, empty on failure
+        std::vector<unsigned char> bytecode;
+
+        std::vector<Diagnostic> diagnostics;
+    };
+
+    // never prints and never exits, any number of threads can assemble at once
+    AssemblyOutput assembleSource(const char *source, std::size_t size,
+                                  const AssemblyOptions &options = AssemblyOptions());
+
+    AssemblyOutput assembleSource(const std::string &source, const AssemblyOptions &options = AssemblyOptions());
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+// stdlib headers
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <mutex>
+
+// other libraries
+#include <termcolor/termcolor.hpp>
+
+namespace CCA {
+    // where the messages of this thread go, std::cout unless a ConsoleCapture is collecting them
+    std::ostream *&consoleStream() {
+        static thread_local std::ostream *stream = &std::cout;
+        return stream;
+    }
+
+    std::ostream &console() {
+        return *consoleStream();
+    }
+
+    // held while a capture prints, so the messages of two threads never mix
+    std::mutex &consoleLock() {
+        static std::mutex lock;
+        return lock;
+    }
+
+    // collects the messages of this thread and prints them in one piece, parallel builds would interleave
+    // their lines otherwise
+    class ConsoleCapture {
+    private:
+        std::ostringstream buffer;
+        std::ostream *previous;
+
+    public:
+        ConsoleCapture() : previous(consoleStream()) {
+            // the buffer is no terminal, keep the colors if the real output is one
+            if (termcolor::_internal::is_colorized(*previous))
+                buffer << termcolor::colorize;
+
+            consoleStream() = &buffer;
+        }
+
+        ConsoleCapture(const ConsoleCapture &) = delete;
+        ConsoleCapture &operator=(const ConsoleCapture &) = delete;
+
+        ~ConsoleCapture() {
+            release();
+            consoleStream() = previous;
+        }
+
+        // prints what was collected so far
+        void release() {
+            std::string text = buffer.str();
+            buffer.str("");
+
+            if (text.empty())
+                return;
+
+            std::lock_guard<std::mutex> guard(consoleLock());
+            *previous << text;
+            previous->flush();
+        }
+    };
+}
@@ -0,0 +1,266 @@
+#pragma once
+
+// stdlib headers
+#include <algorithm>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// assembler headers
+#include <cca/assembler.h>
+
+namespace CCA {
+    // the shape of a generated program
+    struct CorpusOptions {
+        uint64_t seed = 1;
+        std::size_t lines = 100000; // instruction lines
+        std::size_t markers = 5000;
+        double jumps = 0.1; // share of the instruction lines that jump to a marker
+        double forward = 0.5; // share of those jumps that go to a marker further down
+        std::size_t defs = 16;
+        std::size_t defLength = 32; // characters of source per def string
+        double escapes = 0.1; // share of a def string that is escape sequences
+        double comments = 0.1; // share of the lines with a trailing comment
+
+        // weight of every operand signature, see operandSignature
+        double formWeights[SIGNATURE_COUNT] = {1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1};
+    };
+
+    // short names of the operand signatures: none, r, n, a, then rr, rn, ra, nr, ... for two operands
+    std::string signatureName(int signature) {
+        const char kinds[] = {'r', 'n', 'a'};
+
+        if (signature == 0)
+            return "none";
+
+        if (signature < 4)
+            return std::string(1, kinds[signature - 1]);
+
+        return std::string(1, kinds[(signature - 4) / 3]) + kinds[(signature - 4) % 3];
+    }
+
+    int parseSignatureName(const std::string &name) {
+        for (int signature = 0; signature < SIGNATURE_COUNT; signature++) {
+            if (signatureName(signature) == name)
+                return signature;
+        }
+
+        return NO_SIGNATURE;
+    }
+
+    // splitmix64, the standard distributions differ between libraries and would break reproducibility
+    class CorpusRandom {
+    private:
+        uint64_t state;
+
+    public:
+        explicit CorpusRandom(uint64_t seed) : state(seed) {}
+
+        uint64_t next() {
+            uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            return z ^ (z >> 31);
+        }
+
+        // in [0, bound)
+        uint64_t below(uint64_t bound) {
+            return bound == 0 ? 0 : next() % bound;
+        }
+
+        // in [0, 1)
+        double unit() {
+            return (next() >> 11) * (1.0 / 9007199254740992.0);
+        }
+
+        bool chance(double probability) {
+            return unit() < probability;
+        }
+    };
+
+    // writes valid CC assembly of the given shape, the same options always give the same program
+    class CorpusGenerator {
+    private:
+        struct Form {
+            int opcode;
+            int signature;
+        };
+
+        CorpusOptions options;
+        CorpusRandom random;
+
+        std::vector<Form> forms;
+        std::vector<double> cumulativeWeights;
+
+        std::string buffer;
+
+        static std::string name(const char *prefix, uint64_t index) {
+            std::string result = prefix;
+
+            do {
+                result += static_cast<char>('a' + index % 26);
+                index /= 26;
+            } while (index);
+
+            return result;
+        }
+
+        void writeNumber() {
+            switch (random.below(4)) {
+                case 0:
+                    buffer += random.chance(0.5) ? "0b101" : "0b1100";
+                    break;
+                case 1:
+                    buffer += "0o" + std::to_string(1 + random.below(7)) + std::to_string(random.below(8));
+                    break;
+                default:
+                    buffer += std::to_string(random.below(100000));
+            }
+        }
+
+        // kind as in operandKind, numbers sometimes name a def
+        void writeOperand(int kind) {
+            if (kind == 0) {
+                buffer += static_cast<char>('a' + random.below(4));
+            } else if (kind == 2) {
+                buffer += "&";
+                buffer += std::to_string(random.below(4096));
+            } else if (options.defs > 0 && random.chance(0.1)) {
+                buffer += name("d_", random.below(options.defs));
+            } else {
+                writeNumber();
+            }
+        }
+
+        void writeDef(std::size_t index) {
+            const char *escapes[] = {"\\n", "\\t", "\\\\", "\\a", "\\b", "\\e", "\\f", "\\r", "\\v"};
+
+            buffer += "def " + name("d_", index) + " \"";
+
+            std::size_t length = 0;
+
+            while (length < options.defLength) {
+                if (random.chance(options.escapes)) {
+                    buffer += escapes[random.below(9)];
+                    length += 2;
+                } else {
+                    // printable, but neither quote nor backslash
+                    char c = static_cast<char>(' ' + random.below(95));
+                    buffer += c == '"' || c == '\'' || c == '\\' ? '_' : c;
+                    length += 1;
+                }
+            }
+
+            buffer += "\"\n";
+        }
+
+        void writeInstruction(std::size_t markersPlaced) {
+            buffer += "    ";
+
+            if (options.markers > 0 && random.chance(options.jumps)) {
+                const char *jumps[] = {"jmp", "je", "jne", "jg", "js", "jo", "call"};
+
+                // forward jumps go to a marker that is not placed yet, if there is one left
+                bool forward = random.chance(options.forward);
+
+                if (markersPlaced == 0 || markersPlaced == options.markers)
+                    forward = markersPlaced == 0;
+
+                uint64_t target = forward ? markersPlaced + random.below(options.markers - markersPlaced)
+                                          : random.below(markersPlaced);
+
+                buffer += jumps[random.below(7)];
+                buffer += " " + name("m_", target);
+            } else {
+                double pick = random.unit() * cumulativeWeights.back();
+                std::size_t i = std::upper_bound(cumulativeWeights.begin(), cumulativeWeights.end(), pick) -
+                                cumulativeWeights.begin();
+
+                const Form &form = forms[std::min(i, forms.size() - 1)];
+                buffer += opcodeNames[form.opcode];
+
+                if (form.signature >= 1 && form.signature < 4) {
+                    buffer += " ";
+                    writeOperand(form.signature - 1);
+                } else if (form.signature >= 4) {
+                    buffer += " ";
+                    writeOperand((form.signature - 4) / 3);
+                    buffer += ", ";
+                    writeOperand((form.signature - 4) % 3);
+                }
+            }
+
+            if (random.chance(options.comments))
+                buffer += " ; generated";
+
+            buffer += "\n";
+        }
+
+    public:
+        explicit CorpusGenerator(const CorpusOptions &_options) : options(_options), random(_options.seed) {
+            // every encodable (opcode, signature) pair, jumps are written separately
+            for (int opcode = 0; opcode < static_cast<int>(Opcode::COUNT); opcode++) {
+                for (int signature = 0; signature < SIGNATURE_COUNT; signature++) {
+                    double weight = options.formWeights[signature];
+
+                    if (weight <= 0 || encodingTable.find(opcode, signature) < 0)
+                        continue;
+
+                    // spread the weight of a form over the opcodes that have it
+                    int opcodes = 0;
+
+                    for (int other = 0; other < static_cast<int>(Opcode::COUNT); other++)
+                        opcodes += encodingTable.find(other, signature) >= 0;
+
+                    forms.push_back(Form{opcode, signature});
+                    cumulativeWeights.push_back((cumulativeWeights.empty() ? 0 : cumulativeWeights.back()) +
+                                                weight / opcodes);
+                }
+            }
+        }
+
+        // false if the weights leave no instruction to generate
+        bool valid() const {
+            return !forms.empty();
+        }
+
+        // returns the number of bytes written
+        std::size_t generate(std::ostream &stream) {
+            std::size_t written = 0;
+            std::size_t markersPlaced = 0;
+
+            auto flush = [&](std::size_t threshold) {
+                if (buffer.size() >= threshold) {
+                    stream.write(buffer.data(), buffer.size());
+                    written += buffer.size();
+                    buffer.clear();
+                }
+            };
+
+            for (std::size_t i = 0; i < options.defs; i++) {
+                writeDef(i);
+                flush(1 << 20);
+            }
+
+            for (std::size_t line = 0; line < options.lines; line++) {
+                // spread the markers evenly over the lines
+                while (markersPlaced < options.markers && markersPlaced * options.lines <= line * options.markers) {
+                    buffer += ":" + name("m_", markersPlaced++) + "\n";
+                }
+
+                writeInstruction(markersPlaced);
+                flush(1 << 20);
+            }
+
+            // markers left over point at the end
+            while (markersPlaced < options.markers)
+                buffer += ":" + name("m_", markersPlaced++) + "\n";
+
+            buffer += "    stp\n";
+            flush(0);
+
+            return written;
+        }
+    };
+}
@@ -0,0 +1,485 @@
+#pragma once
+
+// stdlib headers
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <atomic>
+#include <mutex>
+
+#ifdef CCA_MEM_STATS
+#include <new>
+#endif
+
+// platform headers
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+// other libraries
+#include <termcolor/termcolor.hpp>
+
+// assembler headers
+#include <cca/console.h>
+
+namespace CCA {
+    void writeJsonString(std::ostream &stream, const std::string &value) {
+        stream << '"';
+
+        for (char c: value) {
+            switch (c) {
+                case '"':
+                    stream << "\\\"";
+                    break;
+                case '\\':
+                    stream << "\\\\";
+                    break;
+                case '\n':
+                    stream << "\\n";
+                    break;
+                case '\t':
+                    stream << "\\t";
+                    break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20) {
+                        stream << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c)
+                               << std::dec << std::setfill(' ');
+                    } else {
+                        stream << c;
+                    }
+            }
+        }
+
+        stream << '"';
+    }
+
+    // sizes of what went through the pipeline, reported next to the phase timings
+    struct AssemblyCounts {
+        std::size_t sourceBytes = 0;
+        std::size_t tokens = 0;
+        std::size_t instructions = 0;
+        std::size_t symbols = 0;
+        std::size_t dataBytes = 0;
+        std::size_t codeBytes = 0;
+    };
+
+    struct MemoryCounters {
+        std::size_t allocations = 0;
+        std::size_t allocatedBytes = 0;
+        std::size_t liveBytes = 0;
+        std::size_t peakLiveBytes = 0;
+    };
+
+#ifdef CCA_MEM_STATS
+    // updated by the global operator new and delete at the end of this file
+    namespace MemoryHook {
+        std::atomic<std::size_t> allocations(0);
+        std::atomic<std::size_t> allocatedBytes(0);
+        std::atomic<std::size_t> liveBytes(0);
+        std::atomic<std::size_t> peakLiveBytes(0);
+
+        // every block starts with its size, padded so the memory handed out keeps malloc's alignment
+        const std::size_t HEADER_SIZE = 16;
+
+        void *allocate(std::size_t size) {
+            void *block = std::malloc(size + HEADER_SIZE);
+
+            if (!block)
+                return nullptr;
+
+            *static_cast<std::size_t *>(block) = size;
+
+            allocations.fetch_add(1, std::memory_order_relaxed);
+            allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+
+            std::size_t live = liveBytes.fetch_add(size, std::memory_order_relaxed) + size;
+            std::size_t peak = peakLiveBytes.load(std::memory_order_relaxed);
+
+            while (live > peak && !peakLiveBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed));
+
+            return static_cast<char *>(block) + HEADER_SIZE;
+        }
+
+        void deallocate(void *memory) {
+            if (!memory)
+                return;
+
+            void *block = static_cast<char *>(memory) - HEADER_SIZE;
+
+            liveBytes.fetch_sub(*static_cast<std::size_t *>(block), std::memory_order_relaxed);
+            std::free(block);
+        }
+    }
+#endif
+
+    // the allocation counters are only kept in builds configured with CCA_MEM_STATS
+    bool memoryCountersEnabled() {
+#ifdef CCA_MEM_STATS
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    MemoryCounters readMemoryCounters() {
+        MemoryCounters counters;
+
+#ifdef CCA_MEM_STATS
+        counters.allocations = MemoryHook::allocations.load(std::memory_order_relaxed);
+        counters.allocatedBytes = MemoryHook::allocatedBytes.load(std::memory_order_relaxed);
+        counters.liveBytes = MemoryHook::liveBytes.load(std::memory_order_relaxed);
+        counters.peakLiveBytes = MemoryHook::peakLiveBytes.load(std::memory_order_relaxed);
+#endif
+
+        return counters;
+    }
+
+    // starts measuring a new peak from what is live right now
+    void resetPeakLiveBytes() {
+#ifdef CCA_MEM_STATS
+        MemoryHook::peakLiveBytes.store(MemoryHook::liveBytes.load(std::memory_order_relaxed),
+                                        std::memory_order_relaxed);
+#endif
+    }
+
+    // peak resident set size of the whole process so far, 0 where it is not available
+    std::size_t peakResidentBytes() {
+#if defined(__APPLE__)
+        struct rusage usage;
+        return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+#elif defined(__unix__)
+        struct rusage usage;
+        return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss * 1024 : 0;
+#else
+        return 0;
+#endif
+    }
+
+    // wall time and heap use of every phase of one assembly, each lap closes the phase that started at
+    // the previous one
+    class PhaseTimer {
+    public:
+        typedef std::chrono::high_resolution_clock::time_point TimePoint;
+
+        struct Phase {
+            std::string name;
+            TimePoint begin;
+            TimePoint end;
+            double milliseconds;
+            std::size_t bytes; // what the phase worked through, for the throughput
+
+            std::size_t allocations;
+            std::size_t allocatedBytes;
+            std::size_t peakLiveBytes;
+            std::size_t liveBytes; // still allocated when the phase ended
+        };
+
+    private:
+        std::vector<Phase> phases;
+        TimePoint last;
+        MemoryCounters lastCounters;
+
+    public:
+        PhaseTimer() : last(std::chrono::high_resolution_clock::now()) {
+            resetPeakLiveBytes();
+            lastCounters = readMemoryCounters();
+        }
+
+        void lap(const std::string &name, std::size_t bytes) {
+            auto now = std::chrono::high_resolution_clock::now();
+            MemoryCounters counters = readMemoryCounters();
+
+            phases.push_back(Phase{
+                    name,
+                    last,
+                    now,
+                    std::chrono::duration<double, std::milli>(now - last).count(),
+                    bytes,
+                    counters.allocations - lastCounters.allocations,
+                    counters.allocatedBytes - lastCounters.allocatedBytes,
+                    counters.peakLiveBytes,
+                    counters.liveBytes
+            });
+
+            // measured after pushing the phase, so the record itself counts towards the next one
+            resetPeakLiveBytes();
+            lastCounters = readMemoryCounters();
+            last = std::chrono::high_resolution_clock::now();
+        }
+
+        const std::vector<Phase> &getPhases() const {
+            return phases;
+        }
+
+        double total() const {
+            double milliseconds = 0;
+
+            for (auto &phase: phases)
+                milliseconds += phase.milliseconds;
+
+            return milliseconds;
+        }
+    };
+
+    double megabytesPerSecond(std::size_t bytes, double milliseconds) {
+        if (milliseconds <= 0)
+            return 0;
+
+        return (bytes / 1e6) / (milliseconds / 1e3);
+    }
+
+    // writes Chrome trace events (chrome://tracing, Perfetto) in the JSON array format. Events go out as they
+    // are added and the closing bracket is optional in that format, so a watcher that gets killed still leaves
+    // a trace that loads
+    class Tracer {
+    public:
+        typedef std::chrono::high_resolution_clock::time_point TimePoint;
+
+    private:
+        std::ofstream file;
+        std::mutex lock;
+        TimePoint epoch;
+        bool first = true;
+
+        std::atomic<int> nextThread;
+
+        // small ids are easier to read in the viewer than native thread ids
+        int threadId() {
+            static thread_local int id = nextThread.fetch_add(1);
+            return id;
+        }
+
+        double microseconds(TimePoint time) const {
+            return std::chrono::duration<double, std::micro>(time - epoch).count();
+        }
+
+        void beginEvent() {
+            file << (first ? "[\n" : ",\n");
+            first = false;
+        }
+
+    public:
+        Tracer() : epoch(std::chrono::high_resolution_clock::now()), nextThread(1) {}
+
+        ~Tracer() {
+            close();
+        }
+
+        bool open(const std::string &fileName) {
+            file.open(fileName, std::ios::binary | std::ios::trunc);
+            return file.is_open();
+        }
+
+        bool isOpen() const {
+            return file.is_open();
+        }
+
+        void span(const std::string &name, const std::string &category, TimePoint begin, TimePoint end,
+                  const std::string &fileName = "") {
+            int tid = threadId();
+            std::lock_guard<std::mutex> guard(lock);
+
+            beginEvent();
+            file << "{\"name\":";
+            writeJsonString(file, name);
+            file << ",\"cat\":";
+            writeJsonString(file, category);
+            file << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid << ",\"ts\":" << microseconds(begin)
+                 << ",\"dur\":" << std::chrono::duration<double, std::micro>(end - begin).count();
+
+            if (!fileName.empty()) {
+                file << ",\"args\":{\"file\":";
+                writeJsonString(file, fileName);
+                file << "}";
+            }
+
+            file << "}";
+        }
+
+        void counter(const std::string &name, TimePoint time, const std::vector<std::pair<std::string, double>> &values) {
+            std::lock_guard<std::mutex> guard(lock);
+
+            beginEvent();
+            file << "{\"name\":";
+            writeJsonString(file, name);
+            file << ",\"ph\":\"C\",\"pid\":1,\"ts\":" << microseconds(time) << ",\"args\":{";
+
+            for (std::size_t i = 0; i < values.size(); i++) {
+                file << (i == 0 ? "" : ",");
+                writeJsonString(file, values[i].first);
+                file << ":" << values[i].second;
+            }
+
+            file << "}}";
+        }
+
+        void flush() {
+            std::lock_guard<std::mutex> guard(lock);
+            file.flush();
+        }
+
+        void close() {
+            std::lock_guard<std::mutex> guard(lock);
+
+            if (!file.is_open())
+                return;
+
+            file << (first ? "[" : "") << "\n]\n";
+            file.close();
+        }
+    };
+
+    // the phases of one assembly and what went through them
+    void tracePhases(Tracer &tracer, const std::string &fileName, const PhaseTimer &timer,
+                     const AssemblyCounts &counts) {
+        for (auto &phase: timer.getPhases()) {
+            bool io = phase.name == "read" || phase.name == "write";
+
+            tracer.span(phase.name, io ? "io" : "phase", phase.begin, phase.end, fileName);
+            tracer.counter("throughput", phase.begin, {{"MB/s", megabytesPerSecond(phase.bytes, phase.milliseconds)}});
+        }
+
+        if (timer.getPhases().empty())
+            return;
+
+        PhaseTimer::TimePoint end = timer.getPhases().back().end;
+
+        tracer.counter("throughput", end, {{"MB/s", 0}});
+        tracer.counter("counts", end, {
+                {"tokens", static_cast<double>(counts.tokens)},
+                {"instructions", static_cast<double>(counts.instructions)},
+                {"source bytes", static_cast<double>(counts.sourceBytes)},
+                {"code bytes", static_cast<double>(counts.codeBytes)}
+        });
+    }
+
+    void printPhases(const std::string &fileName, const PhaseTimer &timer, const AssemblyCounts &counts) {
+        console() << termcolor::blue << "[TIME]" << termcolor::reset << " Phases of " << termcolor::green
+                  << fileName << termcolor::reset << ": \n";
+
+        std::ios::fmtflags flags = console().flags();
+        console() << std::fixed << std::setprecision(3);
+
+        for (auto &phase: timer.getPhases()) {
+            console() << "  " << std::left << std::setw(12) << phase.name << std::right << termcolor::blue << " | "
+                      << termcolor::reset << std::setw(10) << phase.milliseconds << " ms" << termcolor::blue
+                      << " | " << termcolor::reset << std::setw(10) << megabytesPerSecond(phase.bytes, phase.milliseconds)
+                      << " MB/s\n";
+        }
+
+        console() << "  " << std::left << std::setw(12) << "total" << std::right << termcolor::blue << " | "
+                  << termcolor::reset << std::setw(10) << timer.total() << " ms\n";
+
+        console().flags(flags);
+
+        console() << termcolor::blue << "  source: " << termcolor::reset << counts.sourceBytes << " bytes, "
+                  << termcolor::blue << "tokens: " << termcolor::reset << counts.tokens << ", "
+                  << termcolor::blue << "instructions: " << termcolor::reset << counts.instructions << ", "
+                  << termcolor::blue << "symbols: " << termcolor::reset << counts.symbols << ", "
+                  << termcolor::blue << "data: " << termcolor::reset << counts.dataBytes << " bytes, "
+                  << termcolor::blue << "code: " << termcolor::reset << counts.codeBytes << " bytes\n\n";
+    }
+
+    // one line JSON record, so runs can be collected and compared by tools
+    void printPhasesJson(const std::string &fileName, const std::string &mode, const PhaseTimer &timer,
+                         const AssemblyCounts &counts) {
+        std::ostringstream record;
+
+        record << "{\"file\":";
+        writeJsonString(record, fileName);
+        record << ",\"mode\":";
+        writeJsonString(record, mode);
+        record << ",\"total_ms\":" << timer.total()
+               << ",\"source_bytes\":" << counts.sourceBytes
+               << ",\"tokens\":" << counts.tokens
+               << ",\"instructions\":" << counts.instructions
+               << ",\"symbols\":" << counts.symbols
+               << ",\"data_bytes\":" << counts.dataBytes
+               << ",\"code_bytes\":" << counts.codeBytes
+               << ",\"phases\":[";
+
+        bool first = true;
+
+        for (auto &phase: timer.getPhases()) {
+            record << (first ? "" : ",") << "{\"name\":";
+            writeJsonString(record, phase.name);
+            record << ",\"ms\":" << phase.milliseconds
+                   << ",\"bytes\":" << phase.bytes
+                   << ",\"mb_per_s\":" << megabytesPerSecond(phase.bytes, phase.milliseconds) << "}";
+            first = false;
+        }
+
+        record << "]}\n";
+
+        console() << record.str();
+    }
+
+    void printMemoryStats(const std::string &fileName, const PhaseTimer &timer) {
+        console() << termcolor::blue << "[MEMORY]" << termcolor::reset << " Heap use by phase of " << termcolor::green
+                  << fileName << termcolor::reset << ": \n";
+
+        if (memoryCountersEnabled()) {
+            console() << "  " << std::left << std::setw(12) << "phase" << std::right << termcolor::blue << " | "
+                      << termcolor::reset << std::setw(12) << "allocations" << termcolor::blue << " | "
+                      << termcolor::reset << std::setw(14) << "bytes" << termcolor::blue << " | "
+                      << termcolor::reset << std::setw(14) << "peak live" << termcolor::blue << " | "
+                      << termcolor::reset << std::setw(14) << "live after" << "\n";
+
+            for (auto &phase: timer.getPhases()) {
+                console() << "  " << std::left << std::setw(12) << phase.name << std::right << termcolor::blue
+                          << " | " << termcolor::reset << std::setw(12) << phase.allocations << termcolor::blue
+                          << " | " << termcolor::reset << std::setw(14) << phase.allocatedBytes << termcolor::blue
+                          << " | " << termcolor::reset << std::setw(14) << phase.peakLiveBytes << termcolor::blue
+                          << " | " << termcolor::reset << std::setw(14) << phase.liveBytes << "\n";
+            }
+        } else {
+            console() << "  allocation counting is not compiled in, configure with -DCCA_MEM_STATS=ON\n";
+        }
+
+        console() << termcolor::blue << "  peak rss: " << termcolor::reset << peakResidentBytes() << " bytes\n\n";
+    }
+}
+
+#ifdef CCA_MEM_STATS
+void *operator new(std::size_t size) {
+    void *memory = CCA::MemoryHook::allocate(size);
+
+    if (!memory)
+        throw std::bad_alloc();
+
+    return memory;
+}
+
+void *operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+    return CCA::MemoryHook::allocate(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+    return CCA::MemoryHook::allocate(size);
+}
+
+void operator delete(void *memory) noexcept {
+    CCA::MemoryHook::deallocate(memory);
+}
+
+void operator delete[](void *memory) noexcept {
+    CCA::MemoryHook::deallocate(memory);
+}
+
+void operator delete(void *memory, const std::nothrow_t &) noexcept {
+    CCA::MemoryHook::deallocate(memory);
+}
+
+void operator delete[](void *memory, const std::nothrow_t &) noexcept {
+    CCA::MemoryHook::deallocate(memory);
+}
+#endif
@@ -0,0 +1,2 @@
+// the translation unit of libcca, assembleSource and the rest of the assembler live in the header
+#include <cca/assembler.h>
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 
 #include <cca/assembler.h>
@@ -13,8 +14,24 @@ int main(int argc, char* argv[]) {
 		("s,silent", "Dont display any info except errors")
 		("h,help", "Display this information")
 		("v,version", "Display the assembler version")
-		("w,watch", "Watch for file changes")
-		("o,output", "Outputs the bytecode to the file named <arg>", cxxopts::value<std::string>());
+		("w,watch", "Watch the files, directories and globs given for changes")
+		("debounce", "Milliseconds of quiet after a change before watch mode rebuilds", cxxopts::value<int>()->default_value("50"))
+		("j,jobs", "Files assembled at once with several inputs or in watch mode (default: one per core)", cxxopts::value<int>())
+		("one-pass", "Assemble in a single pass, patching forward references once they are defined (ignores debug)")
+		("stream", "Assemble in a single pass reading the source a chunk at a time, the memory used grows with the symbols instead of the source (ignores debug)")
+		("time-phases", "Print the time and throughput of every phase, as text or as a json record",
+			cxxopts::value<std::string>()->implicit_value("text"), "text|json")
+		("mem-stats", "Print the heap allocations of every phase and the peak memory use")
+		("serve", "Assemble for clients of the Unix socket <arg> until killed, see serveAssembly for the protocol",
+			cxxopts::value<std::string>())
+		("serve-max-payload", "Refuse --serve requests with a source, path or output name over <arg> bytes (K, M or G suffixes)",
+			cxxopts::value<std::string>()->default_value("64M"))
+		("cache", "Reuse the outputs of sources assembled before, kept in the directory <arg>", cxxopts::value<std::string>())
+		("cache-size", "Evict the least recently used outputs once the cache grows past <arg> bytes (K, M or G suffixes)",
+			cxxopts::value<std::string>()->default_value("256M"))
+		("cache-stats", "Print the hits and misses of the cache at the end")
+		("trace", "Write a chrome://tracing / Perfetto trace of the run to the file named <arg>", cxxopts::value<std::string>())
+		("o,output", "Outputs the bytecode to the file named <arg>, - for standard output (the default for standard input)", cxxopts::value<std::string>());
 
 	cxxopts::ParseResult result;
 	
@@ -28,23 +45,100 @@ int main(int argc, char* argv[]) {
 	cxxopts::PositionalList args = result.unmatched();
 
 	if (result.count("version")) {
-		std::cout << "CCAssembler V1.0.0\n";
+		std::cout << "CCAssembler V" << CCA::assemblerVersion << "\n";
 		std::exit(0);
 	}
 
-	if (result.count("help") || args.size() == 0) {
+	if (result.count("help") || (args.size() == 0 && !result.count("serve"))) {
 		std::cout << options.help() << "\n";
 		std::exit(0);
 	}
 
-	if (args.size() > 0) {
-		std::string fileName = args[0];
+	if (args.size() > 0 || result.count("serve")) {
+		CCA::Tracer tracer;
 
-		if (result.count("watch"))
-			CCA::watchAssembly(fileName, result);
-		else
-			CCA::assemble(fileName, result);
+		if (result.count("trace") && !tracer.open(result["trace"].as<std::string>())) {
+			std::cout << termcolor::red << "[ERROR] " << termcolor::reset << "Could not open trace file '"
+			          << result["trace"].as<std::string>() << "'\n\n";
+			std::exit(-1);
+		}
 
-		std::exit(0);
+		CCA::Tracer *tracing = tracer.isOpen() ? &tracer : nullptr;
+
+		// watch and serve mode assemble what changed anyway, the cache is for the one-shot builds
+		CCA::BuildCache cache;
+		CCA::BuildCache *caching = nullptr;
+
+		if (result.count("cache") && !result.count("watch") && !result.count("serve")) {
+			uint64_t limit = 0;
+
+			if (!CCA::parseByteSize(result["cache-size"].as<std::string>(), limit)) {
+				std::cout << termcolor::red << "[ERROR] " << termcolor::reset << "Invalid cache size '"
+				          << result["cache-size"].as<std::string>() << "'\n\n";
+				std::exit(-1);
+			}
+
+			if (!cache.open(result["cache"].as<std::string>(), limit)) {
+				std::cout << termcolor::red << "[ERROR] " << termcolor::reset << "Could not use cache directory '"
+				          << result["cache"].as<std::string>() << "'\n\n";
+				std::exit(-1);
+			}
+
+			caching = &cache;
+		}
+
+		std::size_t failures = 0;
+
+		try {
+			if (result.count("serve")) {
+#ifdef CCA_HAS_UNIX_SOCKETS
+				CCA::serveAssembly(result["serve"].as<std::string>(), result, tracing);
+#else
+				std::cout << termcolor::red << "[ERROR] " << termcolor::reset << "--serve needs Unix sockets\n\n";
+				throw CCA::AssemblyError();
+#endif
+			}
+
+			std::vector<std::string> inputs = CCA::expandInputs(args);
+
+			if (inputs.empty()) {
+				std::cout << termcolor::red << "[ERROR] " << termcolor::reset << "No input files\n\n";
+				throw CCA::AssemblyError();
+			}
+
+			bool readsInput = std::find(inputs.begin(), inputs.end(), "-") != inputs.end();
+
+			if (readsInput && (inputs.size() > 1 || result.count("watch"))) {
+				std::cout << termcolor::red << "[ERROR] " << termcolor::reset
+				          << "Standard input can only be assembled on its own\n\n";
+				throw CCA::AssemblyError();
+			}
+
+			// the bytecode goes to standard output, the messages have to go elsewhere
+			if (inputs.size() == 1 && CCA::outputFileName(inputs[0], result) == "-")
+				CCA::consoleStream() = &std::cerr;
+
+			if (result.count("watch"))
+				CCA::watchAssembly(inputs, result, tracing);
+			else if (inputs.size() == 1)
+				CCA::assemble(inputs[0], result, tracing, nullptr, caching);
+			else
+				failures = CCA::assembleBatch(inputs, result, tracing, caching);
+		} catch (const CCA::AssemblyError&) {
+			if (caching && result.count("cache-stats"))
+				cache.printStats();
+
+			tracer.close();
+			std::exit(-1);
+		}
+
+		if (caching && result.count("cache-stats"))
+			cache.printStats();
+
+		// std::exit skips the destructors
+		tracer.close();
+
+		// a batch exits with the number of files that failed
+		std::exit(static_cast<int>(std::min<std::size_t>(failures, 255)));
 	}
 }
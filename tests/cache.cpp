@@ -0,0 +1,153 @@
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <cca/assembler.h>
+#include <cca/cache.h>
+
+// BuildCache: a restore puts back what was stored, also once the output is gone, and going over the limit evicts the
+// least recently used entries until three quarters of it are left
+bool passed = true;
+
+void check(bool condition, const std::string &what) {
+	if (!condition) {
+		std::cerr << "[FAIL] " << what << "\n";
+		passed = false;
+	}
+}
+
+#ifdef CCA_HAS_BUILD_CACHE
+std::string directory;
+
+void writeFile(const std::string &fileName, const std::string &contents) {
+	std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+	file << contents;
+}
+
+std::string readWhole(const std::string &fileName) {
+	std::ifstream file(fileName, std::ios::binary);
+	std::ostringstream contents;
+	contents << file.rdbuf();
+	return contents.str();
+}
+
+CCA::BuildCache::Key keyOf(const CCA::BuildCache &cache, const std::string &source) {
+	return cache.key(source.data(), source.size(), CCA::cacheConfiguration());
+}
+
+// where the cache keeps the image of key
+std::string entryOf(const CCA::BuildCache::Key &key) {
+	std::string hex = key.hex();
+	return directory + "/cache/" + hex.substr(0, 2) + "/" + hex + ".ccb";
+}
+
+bool exists(const std::string &fileName) {
+	return access(fileName.c_str(), F_OK) == 0;
+}
+
+// stores an output of size bytes for source, last used seconds ago
+CCA::BuildCache::Key storeOutput(CCA::BuildCache &cache, const std::string &source, std::size_t size,
+                                 time_t age = 0) {
+	std::string output = directory + "/" + source + ".ccb";
+	writeFile(output, std::string(size, source[0]));
+
+	CCA::BuildCache::Key key = keyOf(cache, source);
+	cache.store(key, output);
+
+	if (age) {
+		timeval times[2];
+		times[0].tv_sec = times[1].tv_sec = time(nullptr) - age;
+		times[0].tv_usec = times[1].tv_usec = 0;
+		utimes(entryOf(key).c_str(), times);
+	}
+
+	return key;
+}
+
+std::string totalsLine(const std::string &name) {
+	std::ifstream stats(directory + "/cache/stats");
+	std::string field;
+	std::string value;
+
+	while (stats >> field >> value) {
+		if (field == name)
+			return field + " " + value;
+	}
+
+	return "";
+}
+
+void testRestore() {
+	CCA::BuildCache cache;
+	check(cache.open(directory + "/cache", 1 << 20), "the cache directory opens");
+
+	std::string output = directory + "/restored.ccb";
+	writeFile(output, "image");
+
+	CCA::BuildCache::Key key = keyOf(cache, "restored");
+	check(!cache.restore(key, output), "an empty cache misses");
+
+	cache.store(key, output);
+	unlink(output.c_str());
+
+	check(cache.restore(key, output), "a stored output is restored after it was deleted");
+	check(readWhole(output) == "image", "the restored output has the stored contents");
+
+	// writeBytecode replaces the link, the entry keeps what was stored
+	check(CCA::writeOutputFile(output, nullptr, 0), "the restored output can be written over");
+	check(readWhole(entryOf(key)) == "image", "writing over a restored output leaves the entry alone");
+
+	CCA::BuildCache::Key other = keyOf(cache, "other");
+	check(!cache.restore(other, output), "another source misses");
+	check(keyOf(cache, "restored").hex() == key.hex(), "the key of a source doesn't change");
+}
+
+void testEviction() {
+	CCA::BuildCache cache;
+	check(cache.open(directory + "/cache", 1000), "the cache directory opens with a limit");
+
+	// from old to new: b c d, then a is restored and becomes the newest
+	CCA::BuildCache::Key a = storeOutput(cache, "a", 200, 400);
+	CCA::BuildCache::Key b = storeOutput(cache, "b", 200, 300);
+	CCA::BuildCache::Key c = storeOutput(cache, "c", 200, 200);
+	CCA::BuildCache::Key d = storeOutput(cache, "d", 200, 100);
+	check(cache.restore(a, directory + "/a.ccb"), "a stored entry is restored");
+
+	CCA::BuildCache::Key e = storeOutput(cache, "e", 200);
+	check(exists(entryOf(a)) && exists(entryOf(b)) && exists(entryOf(e)), "nothing is evicted at the limit");
+
+	// 1200 bytes, down to 750 drops b, c and d
+	CCA::BuildCache::Key f = storeOutput(cache, "f", 200);
+
+	check(!exists(entryOf(b)) && !exists(entryOf(c)) && !exists(entryOf(d)), "the least recently used are evicted");
+	check(exists(entryOf(a)) && exists(entryOf(e)) && exists(entryOf(f)), "the recently used entries stay");
+	check(totalsLine("size") == "size 600", "the size is down to three quarters of the limit or less");
+	check(totalsLine("evictions") == "evictions 3", "the evictions are counted");
+}
+#endif
+
+int main() {
+#ifdef CCA_HAS_BUILD_CACHE
+	char name[] = "/tmp/cca-cache-test-XXXXXX";
+
+	if (!mkdtemp(name)) {
+		std::cerr << "[FAIL] could not create a temporary directory\n";
+		return 1;
+	}
+
+	directory = name;
+
+	testRestore();
+
+	// a cache of its own
+	directory += "/eviction";
+	mkdir(directory.c_str(), 0777);
+	testEviction();
+
+	std::system(("rm -rf '" + std::string(name) + "'").c_str());
+#endif
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,82 @@
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <cca/cca.h>
+
+// --one-pass has to find the same errors as the multi-pass pipeline and stop at the same phase, and build the same
+// image when there are none
+struct Case {
+	const char *name;
+	const char *source;
+};
+
+const Case cases[] = {
+		{"duplicate marker before later errors", ":loop\nmov a, 1\n:loop\nmov a\njmp nowhere\nstp\n"},
+		{"lexer errors before semantic ones", "mov a, 99999999999\n:loop\n:loop\njmp nowhere\n\"open\n"},
+		{"bad def after a duplicate marker", ":x\n:x\nmov a\ndef y 1\n"},
+		{"first bad def only", "def 1 \"a\"\ndef b\n"},
+		{"def at the end", "stp\ndef"},
+		{"def defined twice", "def a \"x\"\nmov a, 1\ndef a \"y\"\ndef a \"z\"\n"},
+		{"marker before a def of its name", ":a\nstp\n:a\ndef a \"x\"\n:b\n:b\n"},
+		{"marker after a def of its name", "def a \"x\"\n:a\nstp\n"},
+		{"argument before any opcode", ":a\n:a\n1\n:b\n:b\ndef a \"x\"\n"},
+		{"argument before any opcode after a bad def", "1\ndef 1\n"},
+		{"invalid operands", "mov a\njmp nowhere\nstp a, b, c\nmov 1, a\n"},
+		{"unmatched identifiers in order", "jmp there\nmov a, here\njmp there\n:here\nmov b, gone\n"},
+		{"arguments after a marker", "mov a\n:end\n, 1\njmp end\nstp\n"},
+		{"argument on the line after its opcode", "push\nz\n"},
+		{"argument after a blank line", "jmp\n\n x\n"},
+		{"marker between an opcode and its argument", "jmp\n:x\ny\nstp\n"},
+		{"forward and backward references", "jmp main\n:loop\ncall loop\n:main\njmp loop\nstp\n"},
+		{"empty", ""},
+};
+
+std::string describe(const CCA::AssemblyOutput &output) {
+	std::ostringstream text;
+	text << (output.succeeded ? "succeeded" : "failed") << ", " << output.bytecode.size() << " bytes\n";
+
+	for (const CCA::Diagnostic &diagnostic: output.diagnostics)
+		text << "  " << diagnostic.line << ": " << diagnostic.message << "\n";
+
+	return text.str();
+}
+
+bool compare(const std::string &name, const std::string &source) {
+	CCA::AssemblyOptions onePass;
+	onePass.onePass = true;
+
+	CCA::AssemblyOutput multiPass = CCA::assembleSource(source);
+	CCA::AssemblyOutput single = CCA::assembleSource(source, onePass);
+
+	std::string multiPassResult = describe(multiPass);
+	std::string onePassResult = describe(single);
+
+	if (multiPassResult == onePassResult && multiPass.bytecode == single.bytecode)
+		return true;
+
+	std::cerr << "[FAIL] " << name << "\nmulti-pass: " << multiPassResult << "one-pass: " << onePassResult;
+	return false;
+}
+
+int main() {
+	bool passed = true;
+
+	for (const Case &c: cases)
+		passed = compare(c.name, c.source) && passed;
+
+	std::istringstream examples(CCA_TEST_EXAMPLES);
+	std::string fileName;
+
+	while (std::getline(examples, fileName, ',')) {
+		std::ifstream file(fileName, std::ios::binary);
+		std::ostringstream source;
+		source << file.rdbuf();
+
+		passed = compare(fileName, source.str()) && passed;
+	}
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,116 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include <cca/assembler.h>
+
+// the globs and paths of watch mode: * and ? stay inside a directory, ** crosses them and **/ may match nothing, a
+// leading ./ and a trailing / don't make another file of a path
+struct Case {
+	const char *pattern;
+	const char *path;
+	bool matches;
+};
+
+const Case cases[] = {
+		{"*.cca", "main.cca", true},
+		{"*.cca", "src/main.cca", false},
+		{"*.cca", "main.ccb", false},
+		{"*.cca", ".cca", true},
+		{"*.cca", ".hidden.cca", true},
+		{".*.cca", ".hidden.cca", true},
+		{".*.cca", "main.cca", false},
+		{"?.cca", "a.cca", true},
+		{"?.cca", "ab.cca", false},
+		{"a?b", "a/b", false},
+		{"src/*", "src/", true},
+		{"src/*", "src/main.cca", true},
+		{"src/*", "src/lib/main.cca", false},
+		{"**.cca", "main.cca", true},
+		{"**.cca", "src/lib/main.cca", true},
+		{"**", "", true},
+		{"**", "src/lib/", true},
+		{"src/**/main.cca", "src/main.cca", true},
+		{"src/**/main.cca", "src/a/b/main.cca", true},
+		{"src/**/main.cca", "srcmain.cca", false},
+		{"src/**/main.cca", "src/a/b/main.cca.bak", false},
+		{"src/**", "src/a/b/main.cca", true},
+		{"src/**", "other/main.cca", false},
+		{"**/*.cca", "main.cca", true},
+		{"**/*.cca", "a/main.cca", true},
+		{"*/**/*.cca", "main.cca", false},
+		{"a*b*c", "abc", true},
+		{"a*b*c", "aXbYbZc", true},
+		{"a*b*c", "aXbY/c", false},
+		{"", "", true},
+		{"", "a", false},
+		{"main.cca", "main.cca/", false},
+};
+
+struct Normalized {
+	const char *path;
+	const char *normalized;
+};
+
+const Normalized paths[] = {
+		{"./main.cca", "main.cca"},
+		{"././src/", "src"},
+		{"src//", "src"},
+		{"./", "."},
+		{"/", "/"},
+		{".", "."},
+		{".hidden.cca", ".hidden.cca"},
+		{"../main.cca", "../main.cca"},
+};
+
+int main() {
+	bool passed = true;
+
+	for (const Case &c: cases) {
+		if (CCA::matchesGlob(c.pattern, c.path) != c.matches) {
+			std::cerr << "[FAIL] '" << c.pattern << "' " << (c.matches ? "should match" : "should not match") << " '"
+			          << c.path << "'\n";
+			passed = false;
+		}
+	}
+
+	for (const Normalized &p: paths) {
+		std::string normalized = CCA::normalizePath(p.path);
+
+		if (normalized != p.normalized) {
+			std::cerr << "[FAIL] '" << p.path << "' normalized to '" << normalized << "' instead of '" << p.normalized
+			          << "'\n";
+			passed = false;
+		}
+	}
+
+#ifdef CCA_HAS_DIRENT
+	// a directory given with a trailing / stands for the same files as without it
+	char name[] = "/tmp/cca-glob-test-XXXXXX";
+
+	if (!mkdtemp(name)) {
+		std::cerr << "[FAIL] could not create a temporary directory\n";
+		return 1;
+	}
+
+	std::string directory = name;
+	CCA::WatchTarget plain = CCA::parseWatchTarget(directory);
+	CCA::WatchTarget slashed = CCA::parseWatchTarget(directory + "/");
+
+	if (plain.pattern != directory + "/**.cca" || slashed.pattern != plain.pattern ||
+	    slashed.directory != plain.directory || !slashed.recursive) {
+		std::cerr << "[FAIL] '" << directory << "/' is watched as '" << slashed.pattern << "' in '"
+		          << slashed.directory << "'\n";
+		passed = false;
+	}
+
+	if (!CCA::matchesGlob(slashed.pattern.c_str(), (directory + "/sub/main.cca").c_str())) {
+		std::cerr << "[FAIL] a watched directory doesn't take the files below it\n";
+		passed = false;
+	}
+
+	rmdir(name);
+#endif
+
+	return passed ? 0 : 1;
+}
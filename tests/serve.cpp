@@ -0,0 +1,153 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cca/assembler.h>
+
+// the --serve protocol: the requests a client can send, the ones the server refuses and why, and the answers
+bool passed = true;
+
+void check(bool condition, const std::string &what) {
+	if (!condition) {
+		std::cerr << "[FAIL] " << what << "\n";
+		passed = false;
+	}
+}
+
+#ifdef CCA_HAS_UNIX_SOCKETS
+const std::size_t maxPayload = 1 << 10;
+
+struct Read {
+	CCA::ServeRequest request;
+	std::string problem;
+	bool closed;
+};
+
+// sends what the client writes, hanging up after it, and reads as many requests as asked for from the other end
+std::vector<Read> serve(const std::string &sent, int requests = 1) {
+	int ends[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, ends) != 0) {
+		std::cerr << "[FAIL] could not create a socket pair\n";
+		std::exit(1);
+	}
+
+	// a header longer than the socket buffer would block a write on this thread
+	std::thread client([&]() {
+		CCA::writeAll(ends[1], sent.data(), sent.size());
+		::close(ends[1]);
+	});
+
+	CCA::SocketReader reader(ends[0]);
+	std::vector<Read> reads(requests);
+
+	for (Read &read: reads)
+		read.problem = CCA::readServeRequest(reader, read.request, read.closed, maxPayload);
+
+	::close(ends[0]);
+	client.join();
+
+	return reads;
+}
+
+void testRequests() {
+	std::string source = "mov a, 1\nstp\n";
+
+	std::vector<Read> reads = serve("assemble source:" + std::to_string(source.size()) + "\n" + source +
+	                                "check one-pass path:4 output:3\nmainout", 3);
+
+	check(reads[0].problem.empty() && !reads[0].closed, "an assemble request is read");
+	check(reads[0].request.command == "assemble" && reads[0].request.hasSource && !reads[0].request.hasPath &&
+	      !reads[0].request.onePass && reads[0].request.source == source, "the source of a request is read");
+
+	check(reads[1].problem.empty() && !reads[1].closed, "a second request on the connection is read");
+	check(reads[1].request.command == "check" && reads[1].request.onePass && reads[1].request.path == "main" &&
+	      reads[1].request.output == "out", "the fields of a request are read in order");
+
+	check(reads[2].closed && reads[2].problem.empty(), "a client hanging up between requests is no problem");
+}
+
+void testRefused() {
+	struct Case {
+		std::string sent;
+		std::string problem;
+	};
+
+	const Case cases[] = {
+			{"frobnicate\n", "unknown command 'frobnicate'"},
+			{"\n", "unknown command ''"},
+			{"assemble colour:3\nred", "unknown field 'colour:3'"},
+			{"assemble source\n", "unknown field 'source'"},
+			{"assemble source:x\n", "bad length in 'source:x'"},
+			{"assemble source:1025\n", "payload of 'source:1025' too large, the limit is 1024 bytes"},
+			{"assemble source:99999999999999999999999\n", "bad length in 'source:99999999999999999999999'"},
+			{"assemble\n", "expected either a path or a source"},
+			{"assemble path:1 source:1\nab", "expected either a path or a source"},
+			{"assemble " + std::string(1 << 16, 'x') + "\n", "header line too long"},
+	};
+
+	for (const Case &c: cases) {
+		Read read = serve(c.sent)[0];
+
+		if (read.closed || read.problem != c.problem) {
+			std::cerr << "[FAIL] \"" << c.sent.substr(0, 40) << "\" was answered with \""
+			          << (read.closed ? "closed" : read.problem) << "\" instead of \"" << c.problem << "\"\n";
+			passed = false;
+		}
+	}
+
+	// stoull takes -1 as the largest size there is, either way it is too large
+	for (const char *huge: {"assemble source:18446744073709551615\n", "assemble source:-1\n"}) {
+		Read read = serve(huge)[0];
+		check(!read.closed && read.problem.find("too large") != std::string::npos, "a huge length is too large");
+	}
+
+	Read cut = serve("assemble source:10\nmov")[0];
+	check(cut.closed, "a client hanging up inside a payload is gone");
+
+	Read partial = serve("assemble")[0];
+	check(partial.closed && partial.problem.empty(), "a client hanging up inside a header is gone");
+}
+
+void testAnswers() {
+	CCA::ServeRequest request;
+	request.command = "assemble";
+	request.hasSource = true;
+	request.source = "def hw \"hi\"\nmov a, 0\nmov b, hw\nstp\n";
+
+	CCA::AssemblyOutput expected = CCA::assembleSource(request.source);
+	std::string image(expected.bytecode.begin(), expected.bytecode.end());
+
+	check(CCA::answerServeRequest(request) ==
+	      "ok bytecode:" + std::to_string(image.size()) + " diagnostics:0\n" + image, "an image is answered");
+
+	request.command = "check";
+	check(CCA::answerServeRequest(request) == "ok bytecode:0 diagnostics:0\n", "a check answers no image");
+
+	request.source = "jmp nowhere\n";
+	check(CCA::answerServeRequest(request) ==
+	      "failed bytecode:0 diagnostics:1\n1 Could not match identifier 'nowhere' on line 1\n",
+	      "a failed check answers its diagnostics");
+
+	request.hasSource = false;
+	request.hasPath = true;
+	request.path = "/nonexistent/main.cca";
+	check(CCA::answerServeRequest(request) == "failed bytecode:0 diagnostics:1\n0 Could not open file "
+	                                          "'/nonexistent/main.cca', are you sure it exists?\n",
+	      "a missing path is a diagnostic");
+}
+#endif
+
+int main() {
+#ifdef CCA_HAS_UNIX_SOCKETS
+	// the client of a refused request may still be writing when its socket is closed
+	signal(SIGPIPE, SIG_IGN);
+
+	testRequests();
+	testRefused();
+	testAnswers();
+#endif
+
+	return passed ? 0 : 1;
+}
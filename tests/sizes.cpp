@@ -0,0 +1,53 @@
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include <cca/assembler.h>
+
+// parseByteSize, shared by --cache-size, --serve-max-payload and ccb-corpus: a count with an optional K, M or G,
+// nothing negative and nothing that doesn't fit in 64 bits
+struct Case {
+	const char *value;
+	bool valid;
+	uint64_t size;
+};
+
+const Case cases[] = {
+		{"0", true, 0},
+		{"1048576", true, 1048576},
+		{"512K", true, 512ull << 10},
+		{"512k", true, 512ull << 10},
+		{"64M", true, 64ull << 20},
+		{"1G", true, 1ull << 30},
+		{"18446744073709551615", true, UINT64_MAX},
+		{"17179869183G", true, 17179869183ull << 30},
+		{"17179869184G", false, 0},
+		{"18446744073709551616", false, 0},
+		{"-1", false, 0},
+		{"-1K", false, 0},
+		{"+1", false, 0},
+		{" 1", false, 0},
+		{"", false, 0},
+		{"K", false, 0},
+		{"1T", false, 0},
+		{"1KB", false, 0},
+		{"1 K", false, 0},
+		{"1.5M", false, 0},
+};
+
+int main() {
+	bool passed = true;
+
+	for (const Case &c: cases) {
+		uint64_t size = 0;
+		bool valid = CCA::parseByteSize(c.value, size);
+
+		if (valid != c.valid || (valid && size != c.size)) {
+			std::cerr << "[FAIL] \"" << c.value << "\" parsed as " << (valid ? std::to_string(size) : "invalid")
+			          << "\n";
+			passed = false;
+		}
+	}
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,158 @@
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <cca/assembler.h>
+
+// standard input read a chunk at a time while it is still being written: the tokens have to be the ones of the whole
+// source, whatever pieces it arrives in, and a failed read is an error instead of an empty source
+bool passed = true;
+
+void check(bool condition, const std::string &what) {
+	if (!condition) {
+		std::cerr << "[FAIL] " << what << "\n";
+		passed = false;
+	}
+}
+
+struct Lexed {
+	int type;
+	int line;
+	std::string value;
+	int numeric;
+
+	bool operator==(const Lexed &other) const {
+		return type == other.type && line == other.line && value == other.value && numeric == other.numeric;
+	}
+};
+
+Lexed lexed(const CCA::Token &t) {
+	Lexed l;
+	l.type = static_cast<int>(t.type);
+	l.line = t.lineFound;
+	l.value = t.valString.str();
+	l.numeric = t.valNumeric;
+	return l;
+}
+
+// the pieces are cut inside words, numbers and strings, and a string runs over several of them
+const char *const pieces[] = {
+		"def gree", "ting \"Hello, ", "wor", "ld\\n\"\ndef empty \"\"\n", "\n:ma", "in\n    mov a, 1",
+		"23\n    mov b, gre", "eting ; a comm", "ent\n    push &12\n    mov c, 'multi\nline ", "string'\n",
+		"    syscall\n    jmp ma", "in\nstp",
+};
+
+// makes the read end of a pipe standard input and writes the pieces into it from a thread, with pauses between them
+std::thread feedInput() {
+	int ends[2];
+
+	if (pipe(ends) != 0) {
+		std::cerr << "[FAIL] could not create a pipe\n";
+		std::exit(1);
+	}
+
+	dup2(ends[0], 0);
+	::close(ends[0]);
+
+	int writer = ends[1];
+
+	return std::thread([writer]() {
+		for (const char *piece: pieces) {
+			// shorter than PIPE_BUF, a piece is written whole
+			if (::write(writer, piece, std::strlen(piece)) < 0)
+				break;
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+
+		::close(writer);
+	});
+}
+
+void testPieces() {
+	std::string source;
+
+	for (const char *piece: pieces)
+		source += piece;
+
+	std::vector<Lexed> expected;
+	CCA::Lexer whole{CCA::StringRef(source)};
+	CCA::Token t;
+
+	while (whole.next(t))
+		expected.push_back(lexed(t));
+
+	std::thread feeder = feedInput();
+
+	CCA::ChunkedLexer input;
+	check(input.open("-"), "standard input opens");
+
+	std::vector<Lexed> actual;
+	std::string chunk;
+	std::vector<CCA::Token> tokens;
+	int chunks = 0;
+
+	while (input.next(chunk, tokens)) {
+		for (const CCA::Token &token: tokens)
+			actual.push_back(lexed(token));
+
+		tokens.clear();
+		++chunks;
+	}
+
+	feeder.join();
+
+	check(!whole.failed() && !input.failed(), "the source lexes without errors");
+	check(actual == expected, "the tokens of standard input are the ones of the whole source");
+	check(chunks > 1, "standard input is lexed as it arrives");
+	check(input.size() == source.size(), "every byte of standard input is counted");
+}
+
+// reading a directory fails, which a pipe or a terminal can't be made to do on purpose
+void testReadError() {
+	int directory = ::open("/", O_RDONLY);
+	dup2(directory, 0);
+	::close(directory);
+
+	std::vector<CCA::Diagnostic> diagnostics;
+	CCA::DiagnosticCapture capture(diagnostics);
+
+	CCA::SourceFile source;
+	bool failed = false;
+
+	try {
+		CCA::readFile("-", source, false);
+	} catch (const CCA::AssemblyError &) {
+		failed = true;
+	}
+
+	check(failed, "a failed read of standard input is an error for readFile");
+
+	CCA::ChunkedLexer input;
+	std::string chunk;
+	std::vector<CCA::Token> tokens;
+	failed = false;
+
+	try {
+		input.open("-");
+		input.next(chunk, tokens);
+	} catch (const CCA::AssemblyError &) {
+		failed = true;
+	}
+
+	check(failed, "a failed read of standard input is an error for ChunkedLexer");
+	check(diagnostics.size() == 2 && diagnostics[0].message == "Could not read standard input" &&
+	      diagnostics[1].message == diagnostics[0].message, "a failed read of standard input is reported");
+}
+
+int main() {
+	testPieces();
+	testReadError();
+
+	return passed ? 0 : 1;
+}
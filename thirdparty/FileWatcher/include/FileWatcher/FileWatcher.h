@@ -123,6 +123,10 @@ namespace FW
 		/// Updates the watcher. Must be called often.
 		void update();
 
+		/// Waits up to timeoutMs milliseconds for changes and dispatches them.
+		/// A negative timeout waits until a change arrives.
+		void update(int timeoutMs);
+
 	private:
 		/// The implementation
 		FileWatcherImpl* mImpl;
@@ -29,6 +29,8 @@
 #pragma once
 
 #include "FileWatcher.h"
+#include <chrono>
+#include <thread>
 
 #define FILEWATCHER_PLATFORM_WIN32 1
 #define FILEWATCHER_PLATFORM_LINUX 2
@@ -70,6 +72,15 @@ namespace FW
 		/// Updates the watcher. Must be called often.
 		virtual void update() = 0;
 
+		/// Waits up to timeoutMs milliseconds for changes and dispatches them.
+		/// Backends that can't block on their events poll and sleep instead.
+		virtual void update(int timeoutMs)
+		{
+			update();
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs < 0 ? 50 : timeoutMs));
+		}
+
 		/// Handles the action
 		virtual void handleAction(WatchStruct* watch, const String& filename, unsigned long action) = 0;
 
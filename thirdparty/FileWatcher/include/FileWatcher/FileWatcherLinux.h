@@ -33,6 +33,7 @@
 #if FILEWATCHER_PLATFORM == FILEWATCHER_PLATFORM_LINUX
 
 #include <map>
+#include <vector>
 #include <sys/types.h>
 
 namespace FW
@@ -54,7 +55,7 @@ namespace FW
 		///
 		virtual ~FileWatcherLinux();
 
-		/// Add a directory watch
+		/// Add a directory watch, a recursive watch also follows the subdirectories created later
 		/// @exception FileNotFoundException Thrown when the requested directory does not exist
 		WatchID addWatch(const String& directory, FileWatchListener* watcher, bool recursive);
 
@@ -67,20 +68,27 @@ namespace FW
 		/// Updates the watcher. Must be called often.
 		void update();
 
+		/// Blocks up to timeoutMs milliseconds for changes, negative waits forever.
+		void update(int timeoutMs);
+
 		/// Handles the action
 		void handleAction(WatchStruct* watch, const String& filename, unsigned long action);
 
 	private:
+		/// Adds the inotify watch of a single directory, root is the watch it belongs to or 0 for a new one
+		WatchStruct* watchDirectory(const String& directory, FileWatchListener* watcher, bool recursive, WatchID root);
+
+		/// Watches the directories below parent, announce reports the files found in them as added
+		void watchSubdirectories(WatchStruct* parent, bool announce);
+
 		/// Map of WatchID to WatchStruct pointers
 		WatchMap mWatches;
 		/// The last watchid
 		WatchID mLastWatchID;
 		/// inotify file descriptor
 		int mFD;
-		/// time out data
-		struct timeval mTimeOut;
-		/// File descriptor set
-		fd_set mDescriptorSet;
+		/// Buffer the inotify events are read into
+		std::vector<char> mBuffer;
 
 	};//end FileWatcherLinux
 
@@ -67,6 +67,9 @@ namespace FW
 		/// Updates the watcher. Must be called often.
 		void update();
 
+		/// Blocks up to timeoutMs milliseconds for changes, negative waits forever.
+		void update(int timeoutMs);
+
 		/// Handles the action
 		void handleAction(WatchStruct* watch, const String& filename, unsigned long action);
 
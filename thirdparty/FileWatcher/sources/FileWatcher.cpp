@@ -80,4 +80,10 @@ namespace FW
 		mImpl->update();
 	}
 
+	//--------
+	void FileWatcher::update(int timeoutMs)
+	{
+		mImpl->update(timeoutMs);
+	}
+
 };//namespace FW
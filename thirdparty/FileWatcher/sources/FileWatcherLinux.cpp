@@ -33,8 +33,10 @@
 #include <errno.h>
 #include <unistd.h>
 #include <sys/inotify.h>
+#include <poll.h>
+#include <dirent.h>
 
-#define BUFF_SIZE ((sizeof(struct inotify_event)+FILENAME_MAX)*1024)
+#define BUFF_SIZE ((sizeof(struct inotify_event)+FILENAME_MAX)*16)
 
 namespace FW
 {
@@ -44,6 +46,9 @@ namespace FW
 		WatchID mWatchID;
 		String mDirName;
 		FileWatchListener* mListener;		
+		bool mRecursive;
+		/// the watch that was asked for, subdirectories of a recursive watch are removed with it
+		WatchID mRootID;
 	};
 
 	//--------
@@ -53,10 +58,7 @@ namespace FW
 		if (mFD < 0)
 			fprintf (stderr, "Error: %s\n", strerror(errno));
 		
-		mTimeOut.tv_sec = 0;
-		mTimeOut.tv_usec = 0;
-	   		
-		FD_ZERO(&mDescriptorSet);
+		mBuffer.resize(BUFF_SIZE);
 	}
 
 	//--------
@@ -69,10 +71,24 @@ namespace FW
 			delete iter->second;
 		}
 		mWatches.clear();
+
+		if (mFD >= 0)
+			close(mFD);
 	}
 
 	//--------
 	WatchID FileWatcherLinux::addWatch(const String& directory, FileWatchListener* watcher, bool recursive)
+	{
+		WatchStruct* pWatch = watchDirectory(directory, watcher, recursive, 0);
+
+		if(recursive)
+			watchSubdirectories(pWatch, false);
+
+		return pWatch->mWatchID;
+	}
+
+	//--------
+	WatchStruct* FileWatcherLinux::watchDirectory(const String& directory, FileWatchListener* watcher, bool recursive, WatchID root)
 	{
 		int wd = inotify_add_watch (mFD, directory.c_str(), 
 			IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_MOVED_FROM | IN_DELETE);
@@ -86,15 +102,66 @@ namespace FW
 //			fprintf (stderr, "Error: %s\n", strerror(errno));
 //			return -1;
 		}
+
+		// inotify hands out the same descriptor for a directory that is already watched
+		WatchMap::iterator existing = mWatches.find(wd);
+
+		if(existing != mWatches.end())
+			return existing->second;
 		
 		WatchStruct* pWatch = new WatchStruct();
 		pWatch->mListener = watcher;
 		pWatch->mWatchID = wd;
 		pWatch->mDirName = directory;
+		pWatch->mRecursive = recursive;
+		pWatch->mRootID = root ? root : wd;
 		
 		mWatches.insert(std::make_pair(wd, pWatch));
 	
-		return wd;
+		return pWatch;
+	}
+
+	//--------
+	void FileWatcherLinux::watchSubdirectories(WatchStruct* parent, bool announce)
+	{
+		DIR* dir = opendir(parent->mDirName.c_str());
+		if(!dir)
+			return;
+
+		std::vector<String> directories;
+		struct dirent* entry;
+
+		while((entry = readdir(dir)) != 0)
+		{
+			String name = entry->d_name;
+			if(name == "." || name == "..")
+				continue;
+
+			// lstat, following links to directories could loop forever
+			struct stat info;
+			if(lstat((parent->mDirName + "/" + name).c_str(), &info) != 0)
+				continue;
+
+			if(S_ISDIR(info.st_mode))
+				directories.push_back(parent->mDirName + "/" + name);
+			else if(announce && S_ISREG(info.st_mode) && parent->mListener)
+				parent->mListener->handleFileAction(parent->mWatchID, parent->mDirName, name, Actions::Add);
+		}
+
+		closedir(dir);
+
+		for(std::size_t i = 0; i < directories.size(); ++i)
+		{
+			try
+			{
+				WatchStruct* child = watchDirectory(directories[i], parent->mListener, true, parent->mRootID);
+				watchSubdirectories(child, announce);
+			}
+			catch(const Exception&)
+			{
+				// removed or unreadable by now, there is nothing to watch
+			}
+		}
 	}
 
 	//--------
@@ -115,46 +182,93 @@ namespace FW
 	//--------
 	void FileWatcherLinux::removeWatch(WatchID watchid)
 	{
-		WatchMap::iterator iter = mWatches.find(watchid);
+		WatchMap::iterator iter = mWatches.begin();
 
-		if(iter == mWatches.end())
-			return;
+		// the watch and the subdirectories that were watched for it
+		while(iter != mWatches.end())
+		{
+			if(iter->first != watchid && iter->second->mRootID != watchid)
+			{
+				++iter;
+				continue;
+			}
 
-		WatchStruct* watch = iter->second;
-		mWatches.erase(iter);
+			WatchStruct* watch = iter->second;
+			mWatches.erase(iter++);
 	
-		inotify_rm_watch(mFD, watchid);
+			inotify_rm_watch(mFD, watch->mWatchID);
 		
-		delete watch;
-		watch = 0;
+			delete watch;
+		}
 	}
 
 	//--------
 	void FileWatcherLinux::update()
 	{
-		FD_SET(mFD, &mDescriptorSet);
+		update(0);
+	}
+
+	//--------
+	void FileWatcherLinux::update(int timeoutMs)
+	{
+		struct pollfd descriptor;
+		descriptor.fd = mFD;
+		descriptor.events = POLLIN;
+		descriptor.revents = 0;
+
+		int ret = poll(&descriptor, 1, timeoutMs);
 
-		int ret = select(mFD + 1, &mDescriptorSet, NULL, NULL, &mTimeOut);
 		if(ret < 0)
 		{
-			perror("select");
+			if(errno != EINTR)
+				perror("poll");
+			return;
 		}
-		else if(FD_ISSET(mFD, &mDescriptorSet))
+
+		if(ret == 0 || !(descriptor.revents & POLLIN))
+			return;
+
+		ssize_t len, i = 0;
+
+		len = read (mFD, &mBuffer[0], mBuffer.size());
+
+		while (i < len)
 		{
-			ssize_t len, i = 0;
-			char action[81+FILENAME_MAX] = {0};
-			char buff[BUFF_SIZE] = {0};
+			struct inotify_event *pevent = (struct inotify_event *)&mBuffer[i];
+
+			// events of removed watches (IN_IGNORED) have no listener left
+			WatchMap::iterator watch = mWatches.find(pevent->wd);
 
-			len = read (mFD, buff, BUFF_SIZE);
-		   
-			while (i < len)
+			if(watch != mWatches.end())
 			{
-				struct inotify_event *pevent = (struct inotify_event *)&buff[i];
+				WatchStruct* pWatch = watch->second;
 
-				WatchStruct* watch = mWatches[pevent->wd];
-				handleAction(watch, pevent->name, pevent->mask);
-				i += sizeof(struct inotify_event) + pevent->len;
+				handleAction(pWatch, pevent->len ? pevent->name : "", pevent->mask);
+
+				// follow new directories, the files created in them before the watch was added are reported here
+				if(pWatch->mRecursive && (pevent->mask & IN_ISDIR) && (pevent->mask & (IN_CREATE | IN_MOVED_TO)))
+				{
+					try
+					{
+						WatchStruct* child = watchDirectory(pWatch->mDirName + "/" + pevent->name, pWatch->mListener,
+							true, pWatch->mRootID);
+						watchSubdirectories(child, true);
+					}
+					catch(const Exception&)
+					{
+						// gone again already
+					}
+				}
+
+				// the kernel dropped the watch, its directory was deleted or moved away
+				if(pevent->mask & IN_IGNORED)
+				{
+					mWatches.erase(watch);
+					delete pWatch;
+				}
 			}
+
+			i += sizeof(struct inotify_event) + pevent->len;
 		}
 	}
 
@@ -240,7 +240,14 @@ namespace FW
 	//--------
 	void FileWatcherWin32::update()
 	{
-		MsgWaitForMultipleObjectsEx(0, NULL, 0, QS_ALLINPUT, MWMO_ALERTABLE);
+		update(0);
+	}
+
+	//--------
+	void FileWatcherWin32::update(int timeoutMs)
+	{
+		// the change notifications arrive as completion routines while the wait is alertable
+		MsgWaitForMultipleObjectsEx(0, NULL, timeoutMs < 0 ? INFINITE : timeoutMs, QS_ALLINPUT, MWMO_ALERTABLE);
 	}
 
 	//--------